@@ -0,0 +1,74 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_BENCH_H
+#define VECTREXIA_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+namespace vxbench
+{
+
+// only benchmarks with this in their name are run, set from the command line
+extern const char *filter;
+
+/*
+ * Time fn, which processes `items` items per call, and print the best rate out of several runs
+ */
+template<typename Fn>
+void run(const char *name, size_t items, const char *unit, Fn fn)
+{
+    using clock = std::chrono::steady_clock;
+    constexpr int RUNS = 7;
+    constexpr auto MIN_TIME = std::chrono::milliseconds(20);
+
+    if (filter && !strstr(name, filter))
+        return;
+
+    // warm up, and find out how many calls take long enough to time
+    size_t calls = 1;
+    for (;;) {
+        auto start = clock::now();
+        for (size_t i = 0; i < calls; i++)
+            fn();
+        if (clock::now() - start >= MIN_TIME)
+            break;
+        calls *= 2;
+    }
+
+    double best = 0.0;
+    for (int run = 0; run < RUNS; run++) {
+        auto start = clock::now();
+        for (size_t i = 0; i < calls; i++)
+            fn();
+        std::chrono::duration<double> elapsed = clock::now() - start;
+        best = std::max(best, (items * calls) / elapsed.count());
+    }
+
+    printf("%-40s %12.2f M%s/s\n", name, best / 1.0e6, unit);
+}
+
+void gfxutil_benchmarks();
+void psg_benchmarks();
+
+}
+
+#endif //VECTREXIA_BENCH_H
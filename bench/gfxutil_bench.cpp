@@ -0,0 +1,99 @@
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "gfxutil.h"
+#include "vectorizer.h"
+#include "bench.h"
+
+namespace
+{
+
+// A frame sized buffer of random intensities
+template<typename Pf>
+std::vector<Pf> make_frame()
+{
+    std::vector<Pf> frame(FRAME_WIDTH * FRAME_HEIGHT);
+    uint32_t seed = 1;
+    for (auto &p : frame) {
+        seed = seed * 1103515245u + 12345u;
+        p = Pf{ (seed >> 16 & 0xff) / 255.0f };
+    }
+    return frame;
+}
+
+template<typename PfSrc, typename PfDst>
+void bench_convert(const char *name)
+{
+    static auto src = make_frame<PfSrc>();
+    static std::vector<PfDst> dst(src.size());
+    vxbench::run(name, src.size(), "pixel", [] {
+        vxgfx::convert_row(src.data(), dst.data(), src.size());
+    });
+}
+
+template<typename PfSrc, typename PfDst>
+void bench_convert_palette(const char *name)
+{
+    static auto src = make_frame<PfSrc>();
+    static std::vector<PfDst> dst(src.size());
+    static auto pal = vxgfx::palette<PfDst>::tint(vxgfx::pf_argb_t(0x40, 0xff, 0x40));
+    vxbench::run(name, src.size(), "pixel", [] {
+        vxgfx::convert_row(src.data(), dst.data(), src.size(), pal);
+    });
+}
+
+// The four lines of the debug overlay, in characters per second
+void bench_text()
+{
+    static DebugBuffer db{ vxgfx::pf_argb_t(0) };
+    static const auto colour = vxgfx::pf_argb_t(0xc0, 0x00, 0xff, 0x00);
+    static const vxgfx::glyph_atlas<vxgfx::pf_argb_t> atlas(colour);
+    static const char *lines[] = {
+        "@ 1500000Hz",
+        "Channel A: 93750Hz (noise: 0)",
+        "Channel B: 93750Hz (noise: 0)",
+        "Channel C: 93750Hz (noise: 0)",
+    };
+    size_t chars = 0;
+    for (auto line : lines) {
+        chars += strlen(line);
+    }
+
+    vxbench::run("draw_text std::string", chars, "char", [] {
+        for (int i = 0; i < 4; i++) {
+            vxgfx::draw_text<vxgfx::m_direct>(db, 2, 10 + i * 10, colour, std::string(lines[i]));
+        }
+        db.clear();
+    });
+    vxbench::run("draw_text glyph atlas", chars, "char", [] {
+        for (int i = 0; i < 4; i++) {
+            vxgfx::draw_text(db, atlas, 2, 10 + i * 10, lines[i], strlen(lines[i]));
+        }
+        db.clear();
+    });
+}
+
+}
+
+void vxbench::gfxutil_benchmarks()
+{
+    bench_convert<vxgfx::pf_mono_t, uint8_t>("convert mono -> grey8");
+    bench_convert<vxgfx::pf_mono_t, vxgfx::pf_rgb565_t>("convert mono -> rgb565");
+    bench_convert<vxgfx::pf_mono_t, vxgfx::pf_argb_t>("convert mono -> xrgb8888");
+    bench_convert<vxgfx::pf_mono_t, vxgfx::pf_rgba_t>("convert mono -> rgba");
+    bench_convert_palette<vxgfx::pf_mono_t, vxgfx::pf_rgb565_t>("convert mono -> rgb565 (tint)");
+
+    bench_convert<vxgfx::pf_mono16_t, uint8_t>("convert mono16 -> grey8");
+    bench_convert<vxgfx::pf_mono16_t, vxgfx::pf_rgb565_t>("convert mono16 -> rgb565");
+    bench_convert<vxgfx::pf_mono16_t, vxgfx::pf_argb_t>("convert mono16 -> xrgb8888");
+    bench_convert<vxgfx::pf_mono16_t, vxgfx::pf_rgba_t>("convert mono16 -> rgba");
+    bench_convert_palette<vxgfx::pf_mono16_t, vxgfx::pf_rgb565_t>("convert mono16 -> rgb565 (tint)");
+
+    bench_convert<vxgfx::pf_mono8_t, uint8_t>("convert mono8 -> grey8");
+    bench_convert<vxgfx::pf_mono8_t, vxgfx::pf_rgb565_t>("convert mono8 -> rgb565");
+    bench_convert<vxgfx::pf_mono8_t, vxgfx::pf_argb_t>("convert mono8 -> xrgb8888");
+    bench_convert<vxgfx::pf_mono8_t, vxgfx::pf_rgba_t>("convert mono8 -> rgba");
+    bench_convert_palette<vxgfx::pf_mono8_t, vxgfx::pf_rgb565_t>("convert mono8 -> rgb565 (tint)");
+
+    bench_text();
+}
@@ -0,0 +1,20 @@
+#include <cstdio>
+#include "bench.h"
+
+const char *vxbench::filter = nullptr;
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "vxbench: usage: vxbench [filter]\n");
+        return 1;
+    }
+
+    if (argc == 2)
+        vxbench::filter = argv[1];
+
+    vxbench::gfxutil_benchmarks();
+    vxbench::psg_benchmarks();
+
+    return 0;
+}
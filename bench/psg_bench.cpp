@@ -0,0 +1,51 @@
+#include <cstdint>
+#include "ay38910.h"
+#include "bench.h"
+
+namespace
+{
+
+struct psg_config {
+    const char *name;
+    uint8_t mixer;      // PSG_REG_MIXER_CTRL, 0 enables a channel
+    uint8_t noise;
+    uint8_t amplitude;  // the same for all three channels, 0x10 selects the envelope
+};
+
+// Generate a frame of samples (882 at 44.1kHz, 50fps) per call
+void bench_psg(const psg_config &config)
+{
+    static AY38910 psg;
+    psg = AY38910();
+    psg.Write(PSG_REG_A_FINE, 0x3f);
+    psg.Write(PSG_REG_A_COARSE, 0x01);
+    psg.Write(PSG_REG_B_FINE, 0xa0);
+    psg.Write(PSG_REG_B_COARSE, 0x00);
+    psg.Write(PSG_REG_C_FINE, 0xef);
+    psg.Write(PSG_REG_C_COARSE, 0x00);
+    psg.Write(PSG_REG_NOISE, config.noise);
+    psg.Write(PSG_REG_ENV_FINE, 0x00);
+    psg.Write(PSG_REG_ENV_COARSE, 0x04);
+    psg.Write(PSG_REG_ENV_CTRL, 0x0e);
+    psg.Write(PSG_REG_MIXER_CTRL, config.mixer);
+    psg.Write(PSG_REG_A_AMPL, config.amplitude);
+    psg.Write(PSG_REG_B_AMPL, config.amplitude);
+    psg.Write(PSG_REG_C_AMPL, config.amplitude);
+
+    static int16_t buffer[882];
+    vxbench::run(config.name, 882, "sample", [] {
+        psg.FillBuffer(buffer, 882);
+    });
+}
+
+}
+
+void vxbench::psg_benchmarks()
+{
+    bench_psg({ "psg silent", 0x3f, 0x00, 0x00 });
+    bench_psg({ "psg tone A", 0x3e, 0x00, 0x0f });
+    bench_psg({ "psg tone ABC", 0x38, 0x00, 0x0f });
+    bench_psg({ "psg tone ABC + envelope", 0x38, 0x00, 0x10 });
+    bench_psg({ "psg noise A (period 1)", 0x37, 0x01, 0x0f });
+    bench_psg({ "psg tone + noise ABC (period 31)", 0x00, 0x1f, 0x0f });
+}
@@ -19,10 +19,11 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 #include <cstring>
 #include <cstdio>
 #include <cmath>
-#include <array>
 #include "ay38910.h"
 
-void AY38910::Step(uint8_t bus, uint8_t bc1, uint8_t bc2, uint8_t bdir)
+constexpr int16_t AY38910::amplitude_table[16];
+
+void AY38910::Step(uint64_t cycle, uint8_t bus, uint8_t bc1, uint8_t bc2, uint8_t bdir)
 {
     switch(bdir << 2 | bc2 << 1 | bc1)
     {
@@ -37,7 +38,10 @@ void AY38910::Step(uint8_t bus, uint8_t bc1, uint8_t bc2, uint8_t bdir)
             addr = (uint8_t)(bus & 0xf);
             break;
         case PSG_DWS:
-            Write(addr, bus);
+            regs[addr] = bus;
+            log_.push_back({cycle, addr, bus});
+            if (log_.size() >= LOG_SIZE)
+                Render(cycle);
             break;
         case PSG_DTS:
             // read callback
@@ -59,6 +63,12 @@ void AY38910::Step(uint8_t bus, uint8_t bc1, uint8_t bc2, uint8_t bdir)
 void AY38910::Write(uint8_t reg, uint8_t value)
 {
     regs[reg] = value;
+    Apply(reg, value);
+}
+
+void AY38910::Apply(uint8_t reg, uint8_t value)
+{
+    synth_regs[reg] = value;
 
     switch(reg)
     {
@@ -67,21 +77,21 @@ void AY38910::Write(uint8_t reg, uint8_t value)
         // the maximum value for period is 4095 and the minimum value is 1
         case PSG_REG_A_FINE:
         case PSG_REG_A_COARSE:
-            channel_a.setPeriod((uint8_t) (regs[PSG_REG_A_COARSE] & 0xf), regs[PSG_REG_A_FINE]);
+            channel_a.setPeriod((uint8_t) (synth_regs[PSG_REG_A_COARSE] & 0xf), synth_regs[PSG_REG_A_FINE]);
             break;
 
         case PSG_REG_B_FINE: // same as period A
         case PSG_REG_B_COARSE:
-            channel_b.setPeriod((uint8_t) (regs[PSG_REG_B_COARSE] & 0xf), regs[PSG_REG_B_FINE]);
+            channel_b.setPeriod((uint8_t) (synth_regs[PSG_REG_B_COARSE] & 0xf), synth_regs[PSG_REG_B_FINE]);
             break;
 
         case PSG_REG_C_FINE: // same as period A/B
         case PSG_REG_C_COARSE:
-            channel_c.setPeriod((uint8_t) (regs[PSG_REG_C_COARSE] & 0xf), regs[PSG_REG_C_FINE]);
+            channel_c.setPeriod((uint8_t) (synth_regs[PSG_REG_C_COARSE] & 0xf), synth_regs[PSG_REG_C_FINE]);
             break;
 
         case PSG_REG_NOISE:
-            channel_noise.setPeriod((uint8_t) (regs[PSG_REG_NOISE] & 0x1f));
+            channel_noise.setPeriod((uint8_t) (synth_regs[PSG_REG_NOISE] & 0x1f));
             break;
 
         case PSG_REG_MIXER_CTRL:
@@ -109,7 +119,7 @@ void AY38910::Write(uint8_t reg, uint8_t value)
 
         case PSG_REG_ENV_FINE:
         case PSG_REG_ENV_COARSE:
-            envelope.setPeriod(regs[PSG_REG_ENV_COARSE], regs[PSG_REG_ENV_FINE]);
+            envelope.setPeriod(synth_regs[PSG_REG_ENV_COARSE], synth_regs[PSG_REG_ENV_FINE]);
             break;
         case PSG_REG_ENV_CTRL:
             // control the shape of the envelope
@@ -120,6 +130,18 @@ void AY38910::Write(uint8_t reg, uint8_t value)
     }
 }
 
+void AY38910::SetChannelGain(int channel, float gain)
+{
+    gain_[channel] = gain;
+    mix_gain_[channel] = mute_[channel] ? 0.0f : gain;
+}
+
+void AY38910::SetChannelMute(int channel, bool mute)
+{
+    mute_[channel] = mute;
+    mix_gain_[channel] = mute ? 0.0f : gain_[channel];
+}
+
 void AY38910::SetIOReadCallback(AY38910::read_io_callback func, intptr_t ref)
 {
     read_io_func = func;
@@ -132,22 +154,107 @@ void AY38910::SetRegStoreCallback(AY38910::store_reg_callback func, intptr_t ref
     store_reg_ref = ref;
 }
 
-void AY38910::FillBuffer(uint8_t *buffer, size_t length)
+void AY38910::RunTo(uint64_t tick, bool synthesise)
+{
+    while (tick > tick_)
+    {
+        if (!synthesise)
+        {
+            // the counters only need to be advanced
+            const auto ticks = (uint32_t) std::min<uint64_t>(tick - tick_, UINT32_MAX);
+            Advance(ticks);
+            tick_ += ticks;
+            continue;
+        }
+
+        // make room for the samples when the buffer is full, nobody is reading them
+        uint32_t room = blip_.TicksNeeded(blip_.Capacity());
+        if (room == 0)
+        {
+            blip_.RemoveSamples(blip_.SamplesAvailable());
+            room = blip_.TicksNeeded(blip_.Capacity());
+        }
+        const auto ticks = (uint32_t) std::min<uint64_t>(tick - tick_, room);
+
+        // The output can only change when a generator that is heard changes, so the counters are advanced from one of
+        // those events to the next.
+        Mix(0);
+        for (uint32_t t = 0; t < ticks; )
+        {
+            const uint32_t advance = std::min(ticks - t, NextEvent());
+            Advance(advance);
+            t += advance;
+            Mix(t - 1);
+        }
+        blip_.EndFrame(ticks);
+        tick_ += ticks;
+    }
+}
+
+void AY38910::Replay(uint64_t cycle, bool synthesise)
+{
+    auto write = log_.begin();
+    for (; write != log_.end() && write->cycle <= cycle; ++write)
+    {
+        RunTo(write->cycle / CYCLES_PER_TICK, synthesise);
+        Apply(write->reg, write->value);
+    }
+    log_.erase(log_.begin(), write);
+    RunTo(cycle / CYCLES_PER_TICK, synthesise);
+}
+
+void AY38910::Render(uint64_t cycle)
+{
+    Replay(cycle, true);
+}
+
+void AY38910::Skip(uint64_t cycle)
+{
+    blip_.RemoveSamples(blip_.SamplesAvailable());
+    Replay(cycle, false);
+}
+
+void AY38910::SetSampleRate(uint32_t rate)
 {
-    int16_t ampl_a = 0, ampl_b = 0, ampl_c = 0;
-    memset(buffer, 0, length);
+    blip_.RemoveSamples(blip_.SamplesAvailable());
+    blip_.SetRates(TICK_RATE, rate);
+    sample_rate_ = rate;
+}
 
-    for (int i = 0; i < length; i++)
+size_t AY38910::ReadSamples(int16_t *buffer, size_t length, size_t channels)
+{
+    // 20Hz DC blocker
+    const float pole = 1.0f - (2.0f * 3.14159265f * 20.0f / sample_rate_);
+    float samples[256];
+    size_t read = 0;
+
+    while (read < length)
     {
-        auto noise = channel_noise.step();
-        auto envelope_counter = envelope.step();
+        const size_t count = blip_.ReadSamples(samples, std::min(length - read, sizeof(samples) / sizeof(samples[0])));
+        if (count == 0)
+            break;
 
-        ampl_a = channel_a.step(noise, envelope_counter);
-        ampl_b = channel_b.step(noise, envelope_counter);
-        ampl_c = channel_c.step(noise, envelope_counter);
+        for (size_t i = 0; i < count; i++)
+        {
+            dc_out_ = samples[i] - dc_in_ + pole * dc_out_;
+            dc_in_ = samples[i];
+            const auto sample = (int16_t) std::max(-0x8000, std::min(0x7fff, (int) std::lround(dc_out_)));
+            for (size_t channel = 0; channel < channels; channel++)
+                *(buffer++) = sample;
+        }
+        read += count;
+    }
+    return read;
+}
 
-        *(buffer++) = (uint8_t)((uint16_t)(((channel_a_on ? ampl_a : 0) +
-                                            (channel_b_on ? ampl_b : 0) +
-                                            (channel_c_on ? ampl_c : 0)) / 3.0) >> 8);
+void AY38910::FillBuffer(int16_t *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        const size_t count = std::min<size_t>(length, 256);
+        RunTo(tick_ + blip_.TicksNeeded(count), true);
+        const size_t read = ReadSamples(buffer, count);
+        buffer += read;
+        length -= read;
     }
 }
@@ -20,10 +20,10 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 #define VECTREXIA_AY38910_H
 
 #include <cstdint>
-#include <cmath>
+#include <cstddef>
 #include <algorithm>
-
-const double pi = std::acos(-1);
+#include <vector>
+#include "blipbuffer.h"
 
 enum {
     PSG_NACT,
@@ -60,168 +60,271 @@ class AY38910
     using read_io_callback = uint8_t (*)(intptr_t);
     using store_reg_callback = void (*)(intptr_t, uint8_t);
 
-    template <int sample_rate>
-    struct periodic_t
+public:
+    // The Vectrex clocks the PSG at 1.5MHz. The tone, noise and envelope generators are all counters clocked at
+    // clock / 8, each tone period is two half periods of TP ticks, so the tone frequency is clock / (16 * TP), noise is
+    // shifted every 2 * NP ticks and the envelope takes a step every 2 * EP ticks, 16 steps is clock / (256 * EP).
+    static constexpr uint32_t CLOCK = 1500000;
+    static constexpr uint32_t TICK_RATE = CLOCK / 8;
+    static constexpr uint32_t DEFAULT_SAMPLE_RATE = 44100;
+    // The PSG shares the 1.5MHz clock with the CPU
+    static constexpr uint32_t CYCLES_PER_TICK = 8;
+
+    static constexpr int16_t amplitude_table[16] = { 0x0000, 0x0055, 0x0079, 0x00AB, 0x00F1, 0x0155, 0x01E3, 0x02AA,
+                                                     0x03C5, 0x0555, 0x078B, 0x0AAB, 0x0F16, 0x1555, 0x1E2B, 0x2AAA };
+
+private:
+    struct tone_t
     {
         uint16_t period_ = 1;
-        double frequency_;
-        double velocity_ = 0.0;
-
-        const int16_t amplitude_table[16] = { 0x0000, 0x0055, 0x0079, 0x00AB, 0x00F1, 0x0155, 0x01E3, 0x02AA,
-                                              0x03C5, 0x0555, 0x078B, 0x0AAB, 0x0F16, 0x1555, 0x1E2B, 0x2AAA };
+        uint16_t count_ = 0;
+        uint8_t output_ = 0;
+        double frequency_ = CLOCK / 16.0;
 
         double setPeriod(uint8_t coarse, uint8_t fine)
         {
             period_ = std::max<uint16_t>((uint16_t) ((coarse << 8) | fine), 1);
-            frequency_ = 1.5e6/(period_ * 16);
-            velocity_ = (frequency_ / (double)sample_rate) * 4.0;
+            frequency_ = CLOCK / (period_ * 16.0);
             return frequency_;
         }
-        double setPeriod(uint8_t fine)
+
+        // ticks until the output toggles, the count can be past a period that was just lowered
+        inline uint32_t remaining() const
         {
-            return setPeriod(0, fine);
+            return (count_ >= period_) ? 1u : (uint32_t) (period_ - count_);
         }
 
+        // the output toggles every period ticks
+        inline void advance(uint32_t ticks)
+        {
+            const uint32_t first = remaining();
+            if (ticks < first)
+            {
+                count_ = (uint16_t) (count_ + ticks);
+                return;
+            }
+            const uint32_t rest = ticks - first;
+            output_ ^= (uint8_t) ((1 + rest / period_) & 1);
+            count_ = (uint16_t) (rest % period_);
+        }
+
+        inline void tick()
+        {
+            advance(1);
+        }
     };
 
-    template <int sample_rate>
-    struct channel_t : periodic_t<sample_rate>
+    struct channel_t : tone_t
     {
         uint8_t  amplitude_mode  = 0; // fixed or envelope variable
-        uint8_t  amplitude_fixed;
-        bool enabled, noise_enabled;
-        double radian_;
+        uint8_t  amplitude_fixed = 0;
+        bool enabled = false, noise_enabled = false;
 
-        int16_t step(int16_t noise, uint8_t envelope)
+        // The tone and noise are gates, a disabled generator holds its gate open. So a channel with both disabled
+        // outputs a level that can be modulated by the volume.
+        inline int16_t output(uint8_t noise, uint8_t envelope) const
         {
-            int16_t out;
-
-            if (noise_enabled)
-            {
-                out = noise;
-            }
-            else if (!enabled) // redundant - && !noise_enabled)
-            {
-                // if the channel is disable and the noise is disabled then the sound can be modulated by the volume
-                out = 1;
-            }
-            else // enabled channel
-            {
-                out = (int16_t) ((std::sin(radian_) > 0.0 ? 1.0 : -1.0));
-            }
-
-            radian_ += periodic_t<sample_rate>::velocity_;
-            return out * amplitude(envelope);
-
+            const bool gate = (tone_t::output_ || !enabled) && (noise || !noise_enabled);
+            const int16_t level = amplitude(envelope);
+            return gate ? level : (int16_t) -level;
         }
 
         inline int16_t amplitude(uint8_t envelope_amplitude) const
         {
-            //return periodic_t<sample_rate>::amplitude_table[amplitude_fixed];
             if (!amplitude_mode)
-                return periodic_t<sample_rate>::amplitude_table[amplitude_fixed];
+                return amplitude_table[amplitude_fixed];
             else
-                return periodic_t<sample_rate>::amplitude_table[envelope_amplitude];
+                return amplitude_table[envelope_amplitude];
         }
     };
 
-    template <int sample_rate>
-    struct noise_t : periodic_t<sample_rate>
+    struct noise_t
     {
+        uint16_t period_ = 1;
+        uint16_t count_ = 0;
         uint32_t rng = 1;
-        double tick_count_ = 0.0;
-        // returns one sample, the time period covered by this method is 1/sample_rate
-        // the rng is ticking a long at frequency = 1.5e6/(period * 16);
-        int16_t step()
+
+        void setPeriod(uint8_t period)
+        {
+            period_ = std::max<uint16_t>(period, 1);
+        }
+
+        // ticks until the next shift
+        inline uint32_t remaining() const
         {
-            while (tick_count_ > 1.0)
+            return (count_ >= period_ * 2u) ? 1u : (uint32_t) (period_ * 2u - count_);
+        }
+
+        // Ticks until the output changes. The output is bit 0 and every shift moves the next bit down, so the next 16
+        // outputs are already in the register.
+        inline uint32_t until_change() const
+        {
+            const uint32_t diff = (rng ^ (0u - (rng & 1))) & 0x1fffe;
+            uint32_t shifts = 1;
+            while (shifts < 16 && !((diff >> shifts) & 1))
+                shifts++;
+            return remaining() + (shifts - 1) * period_ * 2u;
+        }
+
+        // The 17 bit LFSR shifts bit 0 ^ bit 3 into bit 16. The first 14 shifts only feed back bits that are already
+        // in the register, so they can be done at once.
+        inline void shift(uint32_t n)
+        {
+            while (n > 0)
             {
-                rng ^= (((rng & 1) ^ ((rng >> 3) & 1)) << 17);
-                rng >>= 1;
-                tick_count_ -= 1.0;
+                const uint32_t k = std::min(n, 14u);
+                const uint32_t feedback = (rng ^ (rng >> 3)) & ((1u << k) - 1);
+                rng = (rng >> k) | (feedback << (17 - k));
+                n -= k;
             }
+        }
+
+        // the LFSR is shifted every 2 * period ticks
+        inline void advance(uint32_t ticks)
+        {
+            const uint32_t first = remaining();
+            if (ticks < first)
+            {
+                count_ = (uint16_t) (count_ + ticks);
+                return;
+            }
+            const uint32_t rest = ticks - first;
+            shift(1 + rest / (period_ * 2u));
+            count_ = (uint16_t) (rest % (period_ * 2u));
+        }
 
-            tick_count_ += periodic_t<sample_rate>::velocity_;
-            return (int16_t) (rng & 1);
+        inline void tick()
+        {
+            advance(1);
+        }
+
+        inline uint8_t output() const
+        {
+            return (uint8_t) (rng & 1);
         }
     };
 
-    template <int sample_rate>
-    struct envelope_t : periodic_t<sample_rate>
+    struct envelope_t
     {
-        uint8_t counter = 0, envelope_cycle = 0;
-        uint8_t hold, attack, alternate, cont, direction;
+        uint16_t period_ = 1;
+        uint32_t count_ = 0;
+        // step counts down from 15 to 0 through a cycle of the envelope, the volume is step ^ attack
+        int8_t step_ = 0xf;
+        uint8_t attack = 0, alternate = 0, hold = 0;
         bool holding = false;
-        double tick_count_ = 0.0;
 
-        void setControl(uint8_t value)
+        void setPeriod(uint8_t coarse, uint8_t fine)
         {
-            hold      = (uint8_t) (value & 1);
-            attack    = (uint8_t) ((value >> 1) & 1);
-            alternate = (uint8_t) ((value >> 2) & 1);
-            cont      = (uint8_t) ((value >> 3) & 1);
-            direction = attack;
-            holding   = false;
-            //printf("Envelope control changed: continue=%d, attack=%d, alternate=%d, hold=%d\n",
-            //           cont, attack, alternate, hold);
+            period_ = std::max<uint16_t>((uint16_t) ((coarse << 8) | fine), 1);
         }
 
-        inline void step_cycle()
+        // B3 continue, B2 attack, B1 alternate, B0 hold
+        void setControl(uint8_t value)
         {
-            // the divider is really 256 but we need the counter to go at 16 * that
-            // ie. a cycle last 16 ticks (16*16 = 265)
-            if ((envelope_cycle++ & 0xf) == 0xf)
+            attack = (uint8_t) ((value & 4) ? 0xf : 0x0);
+            if (!(value & 8))
+            {
+                // without continue, the envelope holds at 0 after the first cycle
+                hold = 1;
+                alternate = attack;
+            }
+            else
             {
-                envelope_cycle = 0;
+                hold = (uint8_t) (value & 1);
+                alternate = (uint8_t) ((value >> 1) & 1);
+            }
+            step_ = 0xf;
+            count_ = 0;
+            holding = false;
+        }
 
-                holding = hold;
-                // toggle the direction of the counter
-                if (alternate)
-                {
-                    direction ^= 1;
-                }
+        // ticks until the next step, a holding envelope never steps
+        inline uint32_t remaining() const
+        {
+            if (holding)
+                return UINT32_MAX;
+            return (count_ >= period_ * 2u) ? 1u : period_ * 2u - count_;
+        }
 
-                if (cont)
+        inline void advance(uint32_t ticks)
+        {
+            while (!holding && ticks > 0)
+            {
+                const uint32_t first = remaining();
+                if (ticks < first)
                 {
-                    counter = 0;
+                    count_ += ticks;
+                    return;
                 }
+                ticks -= first;
+                count_ = 0;
+                step();
             }
         }
 
-        uint8_t step()
+        inline void tick()
         {
-            while (tick_count_ > 1.0)
-            {
-                //if ((!direction && counter > 0) || (direction && counter < 0xf))
-                //    printf("ticking envelop sub-cycle: counter=%d going %s (holding: %d)\n", counter, (direction) ? "up" : "down", holding);
+            advance(1);
+        }
 
-                step_cycle();
-                if (!holding)
+        inline void step()
+        {
+            if (--step_ < 0)
+            {
+                if (alternate)
+                    attack ^= 0xf;
+                if (hold)
                 {
-                    // direction can be toggled by the alternate flag
-                    // count down to 0 when direction/attack is 0
-                    if (!direction && counter > 0)
-                    {
-                        counter -= 1;
-                    }
-                    // count up to 0xf when direction/attack is 1
-                    else if (direction && counter < 0xf)
-                    {
-                        counter += 1;
-                    }
+                    holding = true;
+                    step_ = 0;
+                }
+                else
+                {
+                    step_ = 0xf;
                 }
-
-                tick_count_ -= 1.0;
             }
+        }
 
-            tick_count_ += periodic_t<sample_rate>::velocity_;
-            return (uint8_t) (counter & 0xf);
+        inline uint8_t volume() const
+        {
+            return (uint8_t) (step_ ^ attack);
         }
     };
 
-    uint8_t regs[0xf];
-    uint8_t addr;
+    // A register write from the bus, timestamped with the CPU cycle it happened on (no padding, it is saved)
+    struct write_t
+    {
+        uint64_t cycle;
+        uint32_t reg, value;
+    };
+
+    // When the log is this long it is rendered, even if nobody asked for the audio
+    static constexpr size_t LOG_SIZE = 4096;
+    static constexpr size_t BLIP_SAMPLES = 4096;
+
+    // regs are the registers as seen on the bus, synth_regs are the registers as far as the synthesiser has got
+    uint8_t regs[0x10] = {};
+    uint8_t synth_regs[0x10] = {};
+    uint8_t addr = 0;
+
+    // Writes from the bus are logged and only applied when the audio up to them is rendered
+    std::vector<write_t> log_;
+    // the time the synthesiser has reached, in ticks
+    uint64_t tick_ = 0;
+
+    // The mixed output is synthesised as band-limited steps at the tick they happen, level_ is the current level
+    // The blip buffer resamples from the tick rate to any output rate, with enough room for a frame at 96kHz
+    uint32_t sample_rate_ = DEFAULT_SAMPLE_RATE;
+    BlipBuffer blip_{TICK_RATE, DEFAULT_SAMPLE_RATE, BLIP_SAMPLES};
+    float level_ = 0.0f;
 
+    // the gain of each channel, and the gain it is mixed with, which is 0 when the channel is muted
+    float gain_[3] = { 1.0f, 1.0f, 1.0f };
+    bool mute_[3] = {};
+    float mix_gain_[3] = { 1.0f, 1.0f, 1.0f };
+
+    // DC blocking filter state, the output is AC coupled like the Vectrex amplifier
+    float dc_in_ = 0.0f, dc_out_ = 0.0f;
 
     // port a/b read callbacks
     store_reg_callback store_reg_func = nullptr;
@@ -229,19 +332,130 @@ class AY38910
     intptr_t           store_reg_ref = 0;
     read_io_callback   read_io_func = nullptr;
     intptr_t           read_io_ref = 0;
+
+    // The number of ticks until the next change of any generator that can be heard
+    inline uint32_t NextEvent() const
+    {
+        uint32_t next = UINT32_MAX;
+        if (channel_a.enabled)
+            next = std::min(next, channel_a.remaining());
+        if (channel_b.enabled)
+            next = std::min(next, channel_b.remaining());
+        if (channel_c.enabled)
+            next = std::min(next, channel_c.remaining());
+        if (channel_a.noise_enabled || channel_b.noise_enabled || channel_c.noise_enabled)
+            next = std::min(next, channel_noise.until_change());
+        if (channel_a.amplitude_mode || channel_b.amplitude_mode || channel_c.amplitude_mode)
+            next = std::min(next, envelope.remaining());
+        return next;
+    }
+
+    inline void Advance(uint32_t ticks)
+    {
+        channel_a.advance(ticks);
+        channel_b.advance(ticks);
+        channel_c.advance(ticks);
+        channel_noise.advance(ticks);
+        envelope.advance(ticks);
+    }
+
+    // Add a step to the output at tick if the mixed level changed
+    inline void Mix(uint32_t tick)
+    {
+        const auto noise = channel_noise.output();
+        const auto envelope_volume = envelope.volume();
+
+        // each channel is at most +/-0x2AAA, so at unity gain the sum of all three fits in 16 bits
+        const float level = channel_a.output(noise, envelope_volume) * mix_gain_[0] +
+                            channel_b.output(noise, envelope_volume) * mix_gain_[1] +
+                            channel_c.output(noise, envelope_volume) * mix_gain_[2];
+
+        if (level != level_)
+        {
+            blip_.AddDelta(tick, level - level_);
+            level_ = level;
+        }
+    }
+
+    void Apply(uint8_t reg, uint8_t value);
+    void RunTo(uint64_t tick, bool synthesise);
+    void Replay(uint64_t cycle, bool synthesise);
+
 public:
+    // The most the logged writes and the samples that were not read add to a state
+    static constexpr size_t MAX_PENDING_STATE = LOG_SIZE * sizeof(write_t) +
+                                                (BLIP_SAMPLES + BlipBuffer::WIDTH) * sizeof(float);
+
+    AY38910()
+    {
+        log_.reserve(LOG_SIZE);
+    }
 
-    bool channel_a_on = true, channel_b_on = true, channel_c_on = true;
+    // the bytes the logged writes and the samples that were not read add to a state
+    size_t PendingStateSize() const
+    {
+        return log_.size() * sizeof(write_t) + (blip_.SamplesAvailable() + BlipBuffer::WIDTH) * sizeof(float);
+    }
 
-    void Step(uint8_t bus, uint8_t bc1, uint8_t bc2, uint8_t bdir);
+    // Update the bus at cycle, writes are logged with the cycle
+    void Step(uint64_t cycle, uint8_t bus, uint8_t bc1, uint8_t bc2, uint8_t bdir);
     void SetIOReadCallback(read_io_callback func, intptr_t ref);
     void SetRegStoreCallback(store_reg_callback func, intptr_t ref);
+    // Write a register now, bypassing the log
     void Write(uint8_t reg, uint8_t value);
-    void FillBuffer(uint8_t * const buffer, size_t length);
 
-    channel_t<44100> channel_a, channel_b, channel_c;
-    noise_t<44100> channel_noise;
-    envelope_t<44100> envelope;
+    // Scale the output of channel 0-2 (A-C), a muted channel keeps its gain for when it is unmuted
+    void SetChannelGain(int channel, float gain);
+    void SetChannelMute(int channel, bool mute);
+
+    // Render the audio up to cycle, applying the logged writes at the time they were made
+    void Render(uint64_t cycle);
+    // Catch up with cycle without synthesising any audio, for when the audio is not wanted
+    void Skip(uint64_t cycle);
+
+    size_t SamplesAvailable() const
+    {
+        return blip_.SamplesAvailable();
+    }
+
+    // Change the output sample rate, the rendered samples that have not been read are dropped
+    void SetSampleRate(uint32_t rate);
+
+    uint32_t SampleRate() const
+    {
+        return sample_rate_;
+    }
+
+    // Read up to length rendered samples as signed 16 bit at the sample rate. Each sample is written to channels
+    // consecutive slots, so interleaved stereo frames can be filled directly.
+    size_t ReadSamples(int16_t *buffer, size_t length, size_t channels = 1);
+
+    // Render another length mono samples from the current state and read them
+    void FillBuffer(int16_t * const buffer, size_t length);
+
+    // The gains and the sample rate are settings, they are kept when a state is loaded
+    template<typename S>
+    void Serialize(S &s)
+    {
+        s.value(regs);
+        s.value(synth_regs);
+        s.value(addr);
+        s.vector(log_);
+        s.value(tick_);
+        s.value(level_);
+        s.value(dc_in_);
+        s.value(dc_out_);
+        s.value(channel_a);
+        s.value(channel_b);
+        s.value(channel_c);
+        s.value(channel_noise);
+        s.value(envelope);
+        blip_.Serialize(s);
+    }
+
+    channel_t channel_a, channel_b, channel_c;
+    noise_t channel_noise;
+    envelope_t envelope;
 };
 
 
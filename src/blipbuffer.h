@@ -0,0 +1,187 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_BLIPBUFFER_H
+#define VECTREXIA_BLIPBUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <vector>
+
+/*
+ * Band-limited step synthesis.
+ *
+ * A square wave sampled at the output rate aliases, every edge is moved to the next sample. A BlipBuffer is given the
+ * changes (deltas) of a signal at their exact clock tick instead. Each delta is added to the buffer as a band-limited
+ * impulse, a windowed sinc taken from a table of PHASES sub-sample offsets, and the impulses are integrated when the
+ * samples are read, which gives band-limited steps. A delta costs WIDTH multiply-adds, whatever the clock rate.
+ *
+ * Ticks are converted to samples with a 32.32 fixed point ratio. The output is delayed by HALF_WIDTH samples.
+ */
+class BlipBuffer
+{
+public:
+    static constexpr int PHASE_BITS = 6;
+    static constexpr int PHASES = 1 << PHASE_BITS;
+    static constexpr int HALF_WIDTH = 8;
+    static constexpr int WIDTH = HALF_WIDTH * 2;
+
+    BlipBuffer(uint32_t clock_rate, uint32_t sample_rate, size_t max_samples)
+    {
+        SetRates(clock_rate, sample_rate);
+        buffer_.assign(max_samples + WIDTH, 0.0f);
+    }
+
+    void SetRates(uint32_t clock_rate, uint32_t sample_rate)
+    {
+        // rounded up, so that TicksNeeded() never comes up short
+        factor_ = (((uint64_t) sample_rate << FRAC_BITS) + clock_rate - 1) / clock_rate;
+    }
+
+    // The most samples that can be buffered
+    size_t Capacity() const
+    {
+        return buffer_.size() - WIDTH;
+    }
+
+    // Add a change of delta to the signal, tick ticks after the start of the frame
+    inline void AddDelta(uint32_t tick, float delta)
+    {
+        const uint64_t pos = offset_ + tick * factor_;
+        const auto &taps = kernel().taps[(pos >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+        float *out = &buffer_[pos >> FRAC_BITS];
+        for (int i = 0; i < WIDTH; i++)
+            out[i] += taps[i] * delta;
+    }
+
+    // The number of ticks the frame must last to complete count samples
+    uint32_t TicksNeeded(size_t count) const
+    {
+        const uint64_t needed = (uint64_t) count << FRAC_BITS;
+        return (needed <= offset_) ? 0 : (uint32_t) ((needed - offset_ + factor_ - 1) / factor_);
+    }
+
+    // End the frame after ticks ticks, the samples before that time are complete and can be read
+    void EndFrame(uint32_t ticks)
+    {
+        offset_ += ticks * factor_;
+    }
+
+    size_t SamplesAvailable() const
+    {
+        return (size_t) (offset_ >> FRAC_BITS);
+    }
+
+    // Integrate and remove count samples, the values are in the units of the deltas
+    size_t ReadSamples(float *out, size_t count)
+    {
+        count = std::min(count, SamplesAvailable());
+        for (size_t i = 0; i < count; i++)
+        {
+            integrator_ += buffer_[i];
+            out[i] = integrator_;
+        }
+        Remove(count);
+        return count;
+    }
+
+    // Drop count samples, the signal carries on from the level they end at
+    size_t RemoveSamples(size_t count)
+    {
+        count = std::min(count, SamplesAvailable());
+        for (size_t i = 0; i < count; i++)
+            integrator_ += buffer_[i];
+        Remove(count);
+        return count;
+    }
+
+    // The rates are settings and are not saved. Only the samples that have been started are saved, the rest of the
+    // buffer is zero.
+    template<typename S>
+    void Serialize(S &s)
+    {
+        s.value(offset_);
+        s.value(integrator_);
+        if (SamplesAvailable() > Capacity()) {
+            offset_ = 0;
+            s.fail();
+            return;
+        }
+        const size_t used = SamplesAvailable() + WIDTH;
+        if (!S::saving)
+            std::fill(buffer_.begin() + used, buffer_.end(), 0.0f);
+        s.bytes(buffer_.data(), used * sizeof(float));
+    }
+
+private:
+    static constexpr int FRAC_BITS = 32;
+
+    void Remove(size_t count)
+    {
+        // move the impulse tails of the remaining samples to the front
+        const size_t remaining = SamplesAvailable() - count + WIDTH;
+        std::memmove(buffer_.data(), buffer_.data() + count, remaining * sizeof(float));
+        std::fill(buffer_.begin() + remaining, buffer_.begin() + remaining + count, 0.0f);
+        offset_ -= (uint64_t) count << FRAC_BITS;
+    }
+
+    struct kernel_table
+    {
+        std::array<std::array<float, WIDTH>, PHASES> taps;
+
+        // Blackman windowed sinc, cut off at 0.45 of the sample rate, each phase sums to 1 so the steps are exact
+        kernel_table()
+        {
+            const double pi = std::acos(-1.0);
+            const double cutoff = 0.45;
+            for (int p = 0; p < PHASES; p++)
+            {
+                const double frac = (p + 0.5) / PHASES;
+                double sum = 0.0;
+                std::array<double, WIDTH> h;
+                for (int i = 0; i < WIDTH; i++)
+                {
+                    const double x = i - (HALF_WIDTH - 1) - frac;
+                    const double s = (x == 0.0) ? 2.0 * cutoff : std::sin(2.0 * pi * cutoff * x) / (pi * x);
+                    const double w = 0.42 + 0.5 * std::cos(pi * x / HALF_WIDTH) + 0.08 * std::cos(2.0 * pi * x / HALF_WIDTH);
+                    h[i] = s * w;
+                    sum += h[i];
+                }
+                for (int i = 0; i < WIDTH; i++)
+                    taps[p][i] = (float) (h[i] / sum);
+            }
+        }
+    };
+
+    static const kernel_table &kernel()
+    {
+        static const kernel_table table;
+        return table;
+    }
+
+    uint64_t factor_ = 0;        // samples per tick, 32.32
+    uint64_t offset_ = 0;        // time of the start of the frame in samples, 32.32
+    float integrator_ = 0.0f;
+    std::vector<float> buffer_;
+};
+
+#endif //VECTREXIA_BLIPBUFFER_H
@@ -16,35 +16,57 @@ GNU General Public License for more details.
 You should have received a copy of the GNU General Public License
 along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <cstdio>
 #include "cartridge.h"
-#include <cstring>
+
+// read when there is no cartridge
+static const std::array<uint8_t, 32768> empty_bank{};
+
+Cartridge::Cartridge()
+{
+    Unload();
+}
 
 void Cartridge::Load(const uint8_t *data, size_t size)
 {
     if (size <= MAX_ROM_SIZE) {
-        // if the ROM is larger than 32K and smaller than or equal to 64K then it uses PB7 for bank switching
-        memcpy(rom_.data(), data, size);
-
-        if (size <= REGULAR_ROM_SIZE)
-        {
-            memcpy(rom_.data()+REGULAR_ROM_SIZE, data, size);
-        }
-        else {
-            printf("[CART]: Loading a bank switched ROM\n");
-        }
-        is_loaded_flag_ = true;
+        Load(RomImage::Copy(data, size, BANK_SIZE));
     }
     else
     {
         Unload();
     }
+}
+
+void Cartridge::Load(std::shared_ptr<const RomImage> image)
+{
+    if (!image || image->size() > MAX_ROM_SIZE) {
+        Unload();
+        return;
+    }
+
+    // the banks are read without bounds checks
+    if (image->readable() < BANK_SIZE || image->readable() % BANK_SIZE != 0) {
+        image = RomImage::Copy(image->data(), image->size(), BANK_SIZE);
+    }
 
+    image_ = std::move(image);
+    banks_ = image_->readable() / BANK_SIZE;
+    if (banks_ > 1) {
+        printf("[CART]: Loading a bank switched ROM (%zu banks)\n", banks_);
+    }
+    latch_ = 0;
+    is_loaded_flag_ = true;
+    Select();
 }
 
 void Cartridge::Unload()
 {
-    rom_.fill(0);
+    image_.reset();
+    banks_ = 0;
+    latch_ = 0;
     is_loaded_flag_ = false;
+    Select();
 }
 
 bool Cartridge::is_loaded()
@@ -52,15 +74,25 @@ bool Cartridge::is_loaded()
     return is_loaded_flag_;
 }
 
-uint8_t Cartridge::Read(uint16_t addr, uint8_t pb6)
+void Cartridge::Select()
 {
-    // bank switch with pb6 by setting the MSB to pb6
-    return rom_[(addr & ~0x8000) | ((pb6 ^ 1) << 15)];
+    if (!banks_) {
+        bank_ = empty_bank.data();
+        return;
+    }
+
+    // a 32K ROM is mapped to both banks
+    const size_t bank = ((size_t) latch_ << 1 | (pb6_ ^ 1)) % banks_;
+    bank_ = image_->data() + bank * BANK_SIZE;
 }
 
-void Cartridge::Write(uint16_t addr, uint8_t data, uint8_t pb6)
+void Cartridge::Write(uint16_t addr, uint8_t data)
 {
     (void)addr;
-    (void)data;
-    (void)pb6;
+
+    // ROMs of up to 64K ignore writes
+    if (banks_ > 2) {
+        latch_ = data;
+        Select();
+    }
 }
@@ -19,26 +19,75 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef VECTREXIA_CARTRIDGE_H
 #define VECTREXIA_CARTRIDGE_H
 
-#include <stdint.h>
+#include <cstdint>
+#include <cstddef>
 #include <array>
+#include <memory>
+#include "romimage.h"
 
+/*
+ * The cartridge port maps a 32K bank of the ROM image to 0000-7FFF.
+ *
+ * A 64K ROM is switched between its two banks with PB6 of the VIA, PB6 high selects the first bank. Larger homebrew
+ * images add a bank latch, written by any write to the cartridge, that selects the pair of banks PB6 switches between.
+ * The selected bank is only looked up when PB6 or the latch change.
+ */
 class Cartridge
 {
-    const int REGULAR_ROM_SIZE = 32768;
-    const int MAX_ROM_SIZE = 65536;
-    // 64K of cartridge for bank switched ROMs
-    std::array<uint8_t, 65536> rom_;
+    static constexpr size_t BANK_SIZE = 32768;
+    static constexpr size_t MAX_BANKS = 512;
+    static constexpr size_t MAX_ROM_SIZE = MAX_BANKS * BANK_SIZE;
+
+    // The image is shared, bank_ points into it
+    std::shared_ptr<const RomImage> image_;
+    size_t banks_ = 0;
+    const uint8_t *bank_ = nullptr;
+    uint8_t pb6_ = 1;
+    uint8_t latch_ = 0;
     bool is_loaded_flag_ = false;
 
+    void Select();
+
 public:
-    Cartridge() = default;
+    Cartridge();
 
+    // Copy the ROM into a new image
     void Load(const uint8_t* data, size_t size);
+    // Share an existing image, an image that can not be read a whole bank at a time is copied
+    void Load(std::shared_ptr<const RomImage> image);
     void Unload();
     bool is_loaded();
 
-    uint8_t Read(uint16_t addr, uint8_t pb6=1);
-    void Write(uint16_t addr, uint8_t data, uint8_t pb6=1);
+    // The loaded image and the number of banks in it, the image is nullptr when no cartridge is loaded
+    const RomImage *image() const { return image_.get(); }
+    size_t banks() const { return banks_; }
+
+    // PB6 has been written, the bank is remapped if it changed
+    inline void SetPB6(uint8_t pb6)
+    {
+        pb6 &= 1;
+        if (pb6 != pb6_) {
+            pb6_ = pb6;
+            Select();
+        }
+    }
+
+    inline uint8_t Read(uint16_t addr) const
+    {
+        return bank_[addr & (BANK_SIZE - 1)];
+    }
+
+    void Write(uint16_t addr, uint8_t data);
+
+    // Only the bank selection is saved, the image is not
+    template<typename S>
+    void Serialize(S &s)
+    {
+        s.value(pb6_);
+        s.value(latch_);
+        if (!S::saving)
+            Select();
+    }
 };
 
 
@@ -27,26 +27,77 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 #include <array>
 #include <memory>
 #include <algorithm>
+#include <limits>
 #include <string>
 #include "veclib.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VXGFX_SSE2 1
+#endif
+
 extern uint8_t font8x8_basic[128][8];
 
 namespace vxgfx
 {
 
 /*
- * color channel blending function
+ * Blend weights are fixed point, 0 is all of the first colour and BLEND_ONE is all of the second colour
+ */
+constexpr unsigned BLEND_ONE = 256;
+
+inline unsigned blend_weight(const float t) {
+    return static_cast<unsigned>(vxl::clamp(t, 0.0f, 1.0f) * BLEND_ONE + 0.5f);
+}
+
+/*
+ * sRGB <-> linear light lookup tables, linear values are 12 bit. Built once on first use.
+ */
+struct gamma_table {
+    static constexpr int LINEAR_MAX = 4095;
+
+    std::array<uint16_t, 256> to_linear;
+    std::array<uint8_t, LINEAR_MAX + 1> to_srgb;
+
+    gamma_table() {
+        for (size_t i = 0; i < to_linear.size(); i++) {
+            const double c = i / 255.0;
+            const double l = (c <= 0.04045) ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+            to_linear[i] = static_cast<uint16_t>(l * LINEAR_MAX + 0.5);
+        }
+        for (size_t i = 0; i < to_srgb.size(); i++) {
+            const double l = static_cast<double>(i) / LINEAR_MAX;
+            const double c = (l <= 0.0031308) ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+            to_srgb[i] = static_cast<uint8_t>(c * 255.0 + 0.5);
+        }
+    }
+};
+
+inline const gamma_table &gamma() {
+    static const gamma_table table;
+    return table;
+}
+
+/*
+ * linear interpolation between a and b, the rounding matches the SIMD row blend exactly
  */
-inline float blend_channel(const float a, const float b, const float t) {
-    return ::sqrt((1.0f - t) * ::pow(a, 2.0f) + t * ::pow(b, 2.0f));
+constexpr int blend_lerp(const int a, const int b, const unsigned t) {
+    return a + (((b - a) * static_cast<int>(t)) >> 8);
+}
+
+/*
+ * color channel blending function, blends in linear light
+ */
+inline uint8_t blend_channel(const uint8_t a, const uint8_t b, const unsigned t) {
+    const auto &g = gamma();
+    return g.to_srgb[blend_lerp(g.to_linear[a], g.to_linear[b], t)];
 }
 
 /*
  * alpha channel blending function
  */
-inline float blend_alpha(const float a, const float b, const float t) {
-    return (1.0f - t) * a + t * b;
+constexpr uint8_t blend_alpha(const uint8_t a, const uint8_t b, const unsigned t) {
+    return static_cast<uint8_t>(blend_lerp(a, b, t));
 }
 
 /*
@@ -136,11 +187,16 @@ struct pf_argb_t {
     }
 
     inline pf_argb_t blend(const pf_argb_t &rhs, const float blend_point) const {
+        return blend_fixed(rhs, blend_weight(blend_point));
+    }
+
+    // Blend towards rhs by weight / BLEND_ONE
+    inline pf_argb_t blend_fixed(const pf_argb_t &rhs, const unsigned weight) const {
         return {
-            static_cast<uint8_t>(blend_alpha(a(),   rhs.a(), blend_point) * 255.0f),
-            static_cast<uint8_t>(blend_channel(r(), rhs.r(), blend_point) * 255.0f),
-            static_cast<uint8_t>(blend_channel(g(), rhs.g(), blend_point) * 255.0f),
-            static_cast<uint8_t>(blend_channel(b(), rhs.b(), blend_point) * 255.0f),
+            blend_alpha(static_cast<uint8_t>(comp_a(*this)), static_cast<uint8_t>(comp_a(rhs)), weight),
+            blend_channel(static_cast<uint8_t>(comp_r(*this)), static_cast<uint8_t>(comp_r(rhs)), weight),
+            blend_channel(static_cast<uint8_t>(comp_g(*this)), static_cast<uint8_t>(comp_g(rhs)), weight),
+            blend_channel(static_cast<uint8_t>(comp_b(*this)), static_cast<uint8_t>(comp_b(rhs)), weight),
         };
     }
 
@@ -195,9 +251,9 @@ struct pf_rgb565_t {
 
     inline explicit pf_rgb565_t(const pf_argb_t v)
         : pf_rgb565_t(
-            static_cast<uint8_t>(v.r() * v.a()),
-            static_cast<uint8_t>(v.g() * v.a()),
-            static_cast<uint8_t>(v.b() * v.a()))
+            static_cast<uint8_t>(pf_argb_t::comp_r(v) * pf_argb_t::comp_a(v) / 0xffu),
+            static_cast<uint8_t>(pf_argb_t::comp_g(v) * pf_argb_t::comp_a(v) / 0xffu),
+            static_cast<uint8_t>(pf_argb_t::comp_b(v) * pf_argb_t::comp_a(v) / 0xffu))
     { /* ... */ }
 
     constexpr pf_rgb565_t(uint8_t r, uint8_t g, uint8_t b) {
@@ -208,6 +264,29 @@ struct pf_rgb565_t {
     }
 };
 
+/*
+ * RGBA pixel format, stored as bytes in R, G, B, A order
+ */
+struct pf_rgba_t {
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+    uint8_t a = 0xff;
+
+    constexpr pf_rgba_t() = default;
+
+    constexpr pf_rgba_t(uint8_t r_, uint8_t g_, uint8_t b_, uint8_t a_ = 0xff)
+        : r(r_), g(g_), b(b_), a(a_)
+    { /* ... */ }
+
+    constexpr explicit pf_rgba_t(const pf_argb_t v)
+        : r(static_cast<uint8_t>(pf_argb_t::comp_r(v))),
+          g(static_cast<uint8_t>(pf_argb_t::comp_g(v))),
+          b(static_cast<uint8_t>(pf_argb_t::comp_b(v))),
+          a(static_cast<uint8_t>(pf_argb_t::comp_a(v)))
+    { /* ... */ }
+};
+
 /*
  * Monochrome luminosity based pixel format
  */
@@ -269,6 +348,11 @@ struct pf_mono_t {
         value = (value * blend_point) + rhs.value * (1.0f - blend_point);
     }
 
+    // Blend towards rhs by weight / BLEND_ONE, luminosity is already linear
+    constexpr pf_mono_t blend_fixed(const pf_mono_t &rhs, const unsigned weight) const {
+        return pf_mono_t{ value + (rhs.value - value) * (weight * (1.0f / BLEND_ONE)) };
+    }
+
     inline pf_mono_t brightness(const pf_mono_t &v) const {
         return pf_mono_t{ value + v.value };
     }
@@ -276,8 +360,452 @@ struct pf_mono_t {
     inline pf_mono_t operator* (float v) const {
         return pf_mono_t{ value * v };
     }
+
+    // 8 bit intensity, for conversion to output formats
+    constexpr uint8_t c8() const {
+        return static_cast<uint8_t>(vxl::clamp(value, 0.0f, 1.0f) * 255.0f);
+    }
+};
+
+/*
+ * Monochrome luminosity based pixel format with integer intensity. Adding brightness saturates at full intensity
+ * instead of overflowing, so additive drawing modes can be used.
+ *
+ * Use pf_mono8_t or pf_mono16_t.
+ */
+template<typename T>
+struct pf_mono_int_t {
+    using value_type = T;
+    static constexpr value_type max_value = std::numeric_limits<T>::max();
+    value_type value = 0;
+
+    pf_mono_int_t() = default;
+    ~pf_mono_int_t() = default;
+    inline pf_mono_int_t(const pf_mono_int_t&) = default;
+    inline pf_mono_int_t(pf_mono_int_t&&) = default;
+    inline pf_mono_int_t &operator=(const pf_mono_int_t&) = default;
+    inline pf_mono_int_t &operator=(pf_mono_int_t &&) = default;
+
+    //
+    // Intensity is between 0.0 and 1.0, values outside that range are clamped
+    constexpr explicit pf_mono_int_t(float intensity) noexcept
+        : value(static_cast<value_type>(vxl::clamp(intensity, 0.0f, 1.0f) * max_value + 0.5f)) {}
+
+    constexpr float a() const {
+        return value * (1.0f / max_value);
+    }
+
+    constexpr float r() const {
+        return a();
+    }
+
+    constexpr float g() const {
+        return a();
+    }
+
+    constexpr float b() const {
+        return a();
+    }
+
+    constexpr static value_type saturating_add(const value_type a, const value_type b) {
+        return (a > max_value - b) ? max_value : static_cast<value_type>(a + b);
+    }
+
+    constexpr void operator+= (const float &v) {
+        *this = brightness(pf_mono_int_t{ v });
+    }
+
+    constexpr void operator+= (const pf_mono_int_t &v) {
+        value = saturating_add(value, v.value);
+    }
+
+    inline pf_mono_int_t blend(const pf_mono_int_t &rhs, const float blend_point) const {
+        return blend_fixed(rhs, blend_weight(blend_point));
+    }
+
+    // Blend towards rhs by weight / BLEND_ONE
+    constexpr pf_mono_int_t blend_fixed(const pf_mono_int_t &rhs, const unsigned weight) const {
+        pf_mono_int_t out;
+        out.value = static_cast<value_type>(blend_lerp(value, rhs.value, weight));
+        return out;
+    }
+
+    constexpr pf_mono_int_t brightness(const pf_mono_int_t &v) const {
+        pf_mono_int_t out;
+        out.value = saturating_add(value, v.value);
+        return out;
+    }
+
+    inline pf_mono_int_t operator* (float v) const {
+        return pf_mono_int_t{ a() * v };
+    }
+
+    // 8 bit intensity, for conversion to output formats
+    constexpr uint8_t c8() const {
+        return static_cast<uint8_t>(value >> ((sizeof(value_type) - 1) * 8));
+    }
 };
 
+template<typename T>
+constexpr typename pf_mono_int_t<T>::value_type pf_mono_int_t<T>::max_value;
+
+using pf_mono8_t = pf_mono_int_t<uint8_t>;
+using pf_mono16_t = pf_mono_int_t<uint16_t>;
+
+/*
+ * Blend a row of src pixels into dst by weight / BLEND_ONE, in linear light.
+ *
+ * The row is processed in chunks: the channels are decoded to linear light through the gamma table, interpolated
+ * eight channels at a time (SSE2, when available) and encoded back to sRGB. The result is identical to calling
+ * pf_argb_t::blend_fixed() on every pixel.
+ */
+inline void blend_row(pf_argb_t *dst, const pf_argb_t *src, size_t n, const unsigned weight) {
+    constexpr size_t CHUNK = 64;
+    const auto &g = gamma();
+    alignas(16) int16_t d[CHUNK * 4];
+    alignas(16) int16_t s[CHUNK * 4];
+
+    for (size_t i = 0; i < n; i += CHUNK) {
+        const size_t m = std::min(CHUNK, n - i);
+
+        for (size_t j = 0; j < m; j++) {
+            const auto dv = dst[i + j].value;
+            const auto sv = src[i + j].value;
+            d[j * 4 + 0] = static_cast<int16_t>(dv >> 24u);
+            d[j * 4 + 1] = static_cast<int16_t>(g.to_linear[(dv >> 16u) & 0xffu]);
+            d[j * 4 + 2] = static_cast<int16_t>(g.to_linear[(dv >> 8u) & 0xffu]);
+            d[j * 4 + 3] = static_cast<int16_t>(g.to_linear[dv & 0xffu]);
+            s[j * 4 + 0] = static_cast<int16_t>(sv >> 24u);
+            s[j * 4 + 1] = static_cast<int16_t>(g.to_linear[(sv >> 16u) & 0xffu]);
+            s[j * 4 + 2] = static_cast<int16_t>(g.to_linear[(sv >> 8u) & 0xffu]);
+            s[j * 4 + 3] = static_cast<int16_t>(g.to_linear[sv & 0xffu]);
+        }
+
+        size_t k = 0;
+#ifdef VXGFX_SSE2
+        // d + ((s - d) * weight >> 8), the values are at most 12 bit so (s - d) * 8 fits in 16 bits and
+        // mulhi((s - d) * 8, weight * 32) is exactly ((s - d) * weight) >> 8
+        const __m128i w = _mm_set1_epi16(static_cast<int16_t>(weight * 32));
+        for (; k + 8 <= m * 4; k += 8) {
+            const __m128i dk = _mm_load_si128(reinterpret_cast<const __m128i *>(d + k));
+            const __m128i sk = _mm_load_si128(reinterpret_cast<const __m128i *>(s + k));
+            const __m128i diff = _mm_slli_epi16(_mm_sub_epi16(sk, dk), 3);
+            _mm_store_si128(reinterpret_cast<__m128i *>(d + k), _mm_add_epi16(dk, _mm_mulhi_epi16(diff, w)));
+        }
+#endif
+        for (; k < m * 4; k++) {
+            d[k] = static_cast<int16_t>(blend_lerp(d[k], s[k], weight));
+        }
+
+        for (size_t j = 0; j < m; j++) {
+            dst[i + j] = pf_argb_t(static_cast<uint8_t>(d[j * 4 + 0]),
+                                   g.to_srgb[d[j * 4 + 1]],
+                                   g.to_srgb[d[j * 4 + 2]],
+                                   g.to_srgb[d[j * 4 + 3]]);
+        }
+    }
+}
+
+/*
+ * Pixel format conversion kernels
+ *
+ * convert_row() converts a row of n monochrome pixels (pf_mono_t, pf_mono16_t or pf_mono8_t) to 8 bit grey,
+ * pf_rgb565_t, pf_argb_t (XRGB8888) or pf_rgba_t. The monochrome pixels are reduced to 8 bit intensity (the same
+ * as c8()) and then expanded to the output format, both steps use SSE2 when it is available. Passing a palette
+ * instead maps every intensity through a lookup table, for tinted output.
+ */
+template<typename Pf>
+struct palette {
+    std::array<Pf, 256> lut;
+
+    // Build a palette that fades from black to colour
+    static palette tint(const pf_argb_t colour) {
+        palette p;
+        for (size_t i = 0; i < p.lut.size(); i++) {
+            const auto scale = [i](uint32_t c) { return static_cast<uint8_t>((c * i + 127) / 255); };
+            p.lut[i] = Pf(pf_argb_t(scale(pf_argb_t::comp_r(colour)),
+                                    scale(pf_argb_t::comp_g(colour)),
+                                    scale(pf_argb_t::comp_b(colour))));
+        }
+        return p;
+    }
+};
+
+template<>
+inline palette<uint8_t> palette<uint8_t>::tint(const pf_argb_t colour) {
+    palette p;
+    const auto grey = pf_mono_t(static_cast<uint8_t>(pf_argb_t::comp_r(colour)),
+                                static_cast<uint8_t>(pf_argb_t::comp_g(colour)),
+                                static_cast<uint8_t>(pf_argb_t::comp_b(colour)));
+    for (size_t i = 0; i < p.lut.size(); i++) {
+        p.lut[i] = static_cast<uint8_t>(grey.value * i / 255.0f + 0.5f);
+    }
+    return p;
+}
+
+//
+// monochrome => 8 bit grey
+
+inline void convert_row(const pf_mono_t *src, uint8_t *dst, size_t n) {
+    size_t i = 0;
+#ifdef VXGFX_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const auto load = [&](size_t pos) {
+        const __m128 v = _mm_loadu_ps(reinterpret_cast<const float *>(src + pos));
+        return _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scale));
+    };
+    for (; i + 16 <= n; i += 16) {
+        const __m128i lo = _mm_packs_epi32(load(i), load(i + 4));
+        const __m128i hi = _mm_packs_epi32(load(i + 8), load(i + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = src[i].c8();
+    }
+}
+
+inline void convert_row(const pf_mono16_t *src, uint8_t *dst, size_t n) {
+    size_t i = 0;
+#ifdef VXGFX_SSE2
+    for (; i + 16 <= n; i += 16) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = src[i].c8();
+    }
+}
+
+inline void convert_row(const pf_mono8_t *src, uint8_t *dst, size_t n) {
+    static_assert(sizeof(pf_mono8_t) == 1, "pf_mono8_t must be a single byte");
+    std::copy_n(reinterpret_cast<const uint8_t *>(src), n, dst);
+}
+
+//
+// 8 bit grey => output formats
+
+inline void convert_row(const uint8_t *src, pf_rgb565_t *dst, size_t n) {
+    size_t i = 0;
+#ifdef VXGFX_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask_rb = _mm_set1_epi16(0xf8);
+    const __m128i mask_g = _mm_set1_epi16(0xfc);
+    const auto expand = [&](__m128i g) {
+        return _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(g, mask_rb), 8),
+                                         _mm_slli_epi16(_mm_and_si128(g, mask_g), 3)),
+                            _mm_srli_epi16(g, 3));
+    };
+    for (; i + 16 <= n; i += 16) {
+        const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), expand(_mm_unpacklo_epi8(g, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), expand(_mm_unpackhi_epi8(g, zero)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = pf_rgb565_t(src[i], src[i], src[i]);
+    }
+}
+
+inline void convert_row(const uint8_t *src, pf_argb_t *dst, size_t n) {
+    size_t i = 0;
+#ifdef VXGFX_SSE2
+    // bytes in memory are B, G, R, A
+    const __m128i alpha = _mm_set1_epi16(static_cast<int16_t>(0xff00));
+    for (; i + 16 <= n; i += 16) {
+        const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+        const __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+        const __m128i ga_lo = _mm_or_si128(_mm_unpacklo_epi8(g, _mm_setzero_si128()), alpha);
+        const __m128i ga_hi = _mm_or_si128(_mm_unpackhi_epi8(g, _mm_setzero_si128()), alpha);
+        auto out = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = pf_argb_t(src[i], src[i], src[i]);
+    }
+}
+
+inline void convert_row(const uint8_t *src, pf_rgba_t *dst, size_t n) {
+    // a grey RGBA pixel has the same bytes as a grey little endian XRGB8888 pixel
+    static_assert(sizeof(pf_rgba_t) == sizeof(pf_argb_t), "pf_rgba_t must be 4 bytes");
+#if defined(VXGFX_SSE2) && !defined(__MSB_FIRST)
+    convert_row(src, reinterpret_cast<pf_argb_t *>(dst), n);
+#else
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = pf_rgba_t(src[i], src[i], src[i]);
+    }
+#endif
+}
+
+template<typename PfDst>
+inline void convert_row(const uint8_t *src, PfDst *dst, size_t n, const palette<PfDst> &pal) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = pal.lut[src[i]];
+    }
+}
+
+//
+// monochrome => output formats, through 8 bit grey
+
+template<typename PfSrc, typename PfDst>
+inline void convert_row(const PfSrc *src, PfDst *dst, size_t n) {
+    constexpr size_t CHUNK = 256;
+    alignas(16) uint8_t grey[CHUNK];
+    for (size_t i = 0; i < n; i += CHUNK) {
+        const size_t m = std::min(CHUNK, n - i);
+        convert_row(src + i, grey, m);
+        convert_row(grey, dst + i, m);
+    }
+}
+
+template<typename PfSrc, typename PfDst>
+inline void convert_row(const PfSrc *src, PfDst *dst, size_t n, const palette<PfDst> &pal) {
+    constexpr size_t CHUNK = 256;
+    alignas(16) uint8_t grey[CHUNK];
+    for (size_t i = 0; i < n; i += CHUNK) {
+        const size_t m = std::min(CHUNK, n - i);
+        convert_row(src + i, grey, m);
+        convert_row(grey, dst + i, m, pal);
+    }
+}
+
+template<typename PfDst>
+inline void convert_row(const pf_mono8_t *src, PfDst *dst, size_t n) {
+    convert_row(reinterpret_cast<const uint8_t *>(src), dst, n);
+}
+
+template<typename PfDst>
+inline void convert_row(const pf_mono8_t *src, PfDst *dst, size_t n, const palette<PfDst> &pal) {
+    convert_row(reinterpret_cast<const uint8_t *>(src), dst, n, pal);
+}
+
+/*
+ * Overlay compositing kernels
+ *
+ * composite_row() alpha blends a row of n ARGB overlay pixels over an output row (source over), the overlay is not
+ * premultiplied. The alpha is scaled to a blend weight, a + a / 128, so that 0 leaves the output untouched and 255
+ * replaces it. Eight pixels (SSE2) are blended at a time, groups that are fully transparent are skipped.
+ */
+constexpr unsigned composite_weight(const unsigned alpha) {
+    return alpha + (alpha >> 7u);
+}
+
+constexpr uint8_t composite_channel(const uint8_t d, const uint8_t s, const unsigned alpha) {
+    return static_cast<uint8_t>(blend_lerp(d, s, composite_weight(alpha)));
+}
+
+inline void composite_row(pf_rgb565_t *dst, const pf_argb_t *src, size_t n) {
+    size_t i = 0;
+#ifdef VXGFX_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask_alpha = _mm_set1_epi32(static_cast<int32_t>(0xff000000u));
+    const __m128i mask_8 = _mm_set1_epi32(0xff);
+    const __m128i mask_5 = _mm_set1_epi16(0x1f);
+    const __m128i mask_6 = _mm_set1_epi16(0x3f);
+    const __m128i mask_rb = _mm_set1_epi16(0xf8);
+    const __m128i mask_g = _mm_set1_epi16(0xfc);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 4));
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(s0, s1), mask_alpha), zero);
+        if (_mm_movemask_epi8(transparent) == 0xffff)
+            continue;
+
+        // eight 16 bit lanes per channel
+        const __m128i sa = _mm_packs_epi32(_mm_srli_epi32(s0, 24), _mm_srli_epi32(s1, 24));
+        const __m128i sr = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 16), mask_8),
+                                           _mm_and_si128(_mm_srli_epi32(s1, 16), mask_8));
+        const __m128i sg = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(s0, 8), mask_8),
+                                           _mm_and_si128(_mm_srli_epi32(s1, 8), mask_8));
+        const __m128i sb = _mm_packs_epi32(_mm_and_si128(s0, mask_8), _mm_and_si128(s1, mask_8));
+
+        // expand the output to 8 bit channels, the same as pf_rgb565_t::r() * 255
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const __m128i d5r = _mm_srli_epi16(d, 11);
+        const __m128i d6g = _mm_and_si128(_mm_srli_epi16(d, 5), mask_6);
+        const __m128i d5b = _mm_and_si128(d, mask_5);
+        const __m128i dr = _mm_or_si128(_mm_slli_epi16(d5r, 3), _mm_srli_epi16(d5r, 2));
+        const __m128i dg = _mm_or_si128(_mm_slli_epi16(d6g, 2), _mm_srli_epi16(d6g, 4));
+        const __m128i db = _mm_or_si128(_mm_slli_epi16(d5b, 3), _mm_srli_epi16(d5b, 2));
+
+        // d + ((s - d) * w >> 8), as in blend_row() mulhi((s - d) * 128, w * 2) is exactly ((s - d) * w) >> 8
+        const __m128i w = _mm_slli_epi16(_mm_add_epi16(sa, _mm_srli_epi16(sa, 7)), 1);
+        const auto lerp = [&w](__m128i dc, __m128i sc) {
+            return _mm_add_epi16(dc, _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(sc, dc), 7), w));
+        };
+        const __m128i r = lerp(dr, sr);
+        const __m128i g = lerp(dg, sg);
+        const __m128i b = lerp(db, sb);
+
+        const __m128i out = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(r, mask_rb), 8),
+                                                      _mm_slli_epi16(_mm_and_si128(g, mask_g), 3)),
+                                         _mm_srli_epi16(b, 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+#endif
+    for (; i < n; i++) {
+        const auto a = pf_argb_t::comp_a(src[i]);
+        if (a == 0)
+            continue;
+        const auto d5r = pf_rgb565_t::comp_r(dst[i]);
+        const auto d6g = pf_rgb565_t::comp_g(dst[i]);
+        const auto d5b = pf_rgb565_t::comp_b(dst[i]);
+        dst[i] = pf_rgb565_t(
+            composite_channel(static_cast<uint8_t>(d5r << 3u | d5r >> 2u), static_cast<uint8_t>(pf_argb_t::comp_r(src[i])), a),
+            composite_channel(static_cast<uint8_t>(d6g << 2u | d6g >> 4u), static_cast<uint8_t>(pf_argb_t::comp_g(src[i])), a),
+            composite_channel(static_cast<uint8_t>(d5b << 3u | d5b >> 2u), static_cast<uint8_t>(pf_argb_t::comp_b(src[i])), a));
+    }
+}
+
+// XRGB8888 output, the output alpha (X) byte is preserved
+inline void composite_row(pf_argb_t *dst, const pf_argb_t *src, size_t n) {
+    size_t i = 0;
+#ifdef VXGFX_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask_alpha = _mm_set1_epi32(static_cast<int32_t>(0xff000000u));
+    for (; i + 4 <= n; i += 4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, mask_alpha), zero);
+        if (_mm_movemask_epi8(transparent) == 0xffff)
+            continue;
+
+        // two pixels per register, four 16 bit lanes each in B, G, R, A order
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const auto lerp = [&zero](__m128i dc, __m128i sc) {
+            const __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sc, _MM_SHUFFLE(3, 3, 3, 3)),
+                                                  _MM_SHUFFLE(3, 3, 3, 3));
+            const __m128i w = _mm_slli_epi16(_mm_add_epi16(a, _mm_srli_epi16(a, 7)), 1);
+            return _mm_add_epi16(dc, _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(sc, dc), 7), w));
+        };
+        const __m128i lo = lerp(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+        const __m128i hi = lerp(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+        const __m128i out = _mm_or_si128(_mm_andnot_si128(mask_alpha, _mm_packus_epi16(lo, hi)),
+                                         _mm_and_si128(mask_alpha, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+    }
+#endif
+    for (; i < n; i++) {
+        const auto a = pf_argb_t::comp_a(src[i]);
+        if (a == 0)
+            continue;
+        dst[i] = pf_argb_t(
+            static_cast<uint8_t>(pf_argb_t::comp_a(dst[i])),
+            composite_channel(static_cast<uint8_t>(pf_argb_t::comp_r(dst[i])), static_cast<uint8_t>(pf_argb_t::comp_r(src[i])), a),
+            composite_channel(static_cast<uint8_t>(pf_argb_t::comp_g(dst[i])), static_cast<uint8_t>(pf_argb_t::comp_g(src[i])), a),
+            composite_channel(static_cast<uint8_t>(pf_argb_t::comp_b(dst[i])), static_cast<uint8_t>(pf_argb_t::comp_b(src[i])), a));
+    }
+}
+
 /*
  * Line drawing mode: direct (overwrite)
  */
@@ -303,9 +831,11 @@ struct m_brightness {
  */
 template <int Bp = 50>
 struct m_blend {
+    static constexpr unsigned weight = Bp * BLEND_ONE / 100;
+
     template<typename Fb, typename Pf = decltype(Fb::value_type)>
     constexpr void operator()(Fb &fb, size_t pos, const Pf &color) const {
-        fb.data()[pos].blend(color, (Bp / 100.0f));
+        fb.data()[pos] = fb.data()[pos].blend_fixed(color, weight);
     }
 };
 
@@ -385,6 +915,44 @@ struct rect_t
     }
 };
 
+/*
+ * Horizontal run of pixels in a row, [left, right)
+ */
+struct span_t
+{
+    int left = std::numeric_limits<int>::max();
+    int right = std::numeric_limits<int>::min();
+
+    constexpr span_t() = default;
+
+    constexpr span_t(int l, int r)
+        : left(l), right(r)
+    { /* ... */
+    }
+
+    constexpr bool empty() const {
+        return left >= right;
+    }
+
+    constexpr int width() const {
+        return empty() ? 0 : right - left;
+    }
+
+    // Grow the span to include the pixel at x
+    constexpr void add(const int x) {
+        left = std::min(left, x);
+        right = std::max(right, x + 1);
+    }
+
+    constexpr void reset() {
+        *this = span_t();
+    }
+};
+
+inline span_t merge(const span_t &a, const span_t &b) {
+    return span_t(std::min(a.left, b.left), std::max(a.right, b.right));
+}
+
 /*
  * Framebuffer class, thin wrapper for an array in a unique_ptr
  *
@@ -463,6 +1031,11 @@ public:
         return buffer.get()->data();
     }
 
+    // Returns a pointer to the first pixel of row y
+    constexpr pointer row(const int y) const {
+        return data() + (y * W);
+    }
+
     const rect_t rect() const {
         return rect_t(W, H);
     }
@@ -501,6 +1074,9 @@ public:
         }
     }
 
+    // Drawing code that writes to row() directly reports the pixels it wrote, see tracked_framebuffer::touch()
+    constexpr void touch(const int /* y */, const int /* left */, const int /* right */) {}
+
     const Pf get_pixel(const int x, const int y) const {
         return (x < width && x >= 0 && y < height && y >= 0)
             ? (*buffer.get())[(y * width) + x] : Pf();
@@ -512,6 +1088,93 @@ private:
     std::unique_ptr<data_type> buffer{};
 };
 
+/*
+ * Framebuffer that keeps track of which part of every row has been drawn to. Clearing only touches the spans
+ * that were drawn since the last clear, and dirty() tells a consumer which pixels may differ from the previous
+ * frame (drawn this frame, or drawn in the last frame and cleared since).
+ *
+ * Usage:
+ *    vxgfx::tracked_framebuffer<WIDTH, HEIGHT, PIXEL_FORMAT> buffer;
+ *    buffer.clear();
+ *    vxgfx::draw_line<vxgfx::m_direct>(buffer, ...);
+ *    for (int y = 0; y < HEIGHT; y++) convert(buffer.row(y), buffer.dirty(y));
+ *
+ */
+template<size_t W, size_t H, typename Pf>
+class tracked_framebuffer : public framebuffer<W, H, Pf>
+{
+    using base_type = framebuffer<W, H, Pf>;
+    using spans_type = std::array<span_t, H>;
+public:
+
+    tracked_framebuffer() = default;
+
+    // The background is the colour that cleared pixels are set to
+    constexpr explicit tracked_framebuffer(Pf background)
+        : base_type(background), background_(background) {}
+
+    // Clears the pixels drawn since the last clear and starts a new frame
+    constexpr void clear() {
+        for (size_t y = 0; y < H; y++) {
+            const auto &span = touched_[y];
+            if (!span.empty()) {
+                auto row = base_type::row(static_cast<int>(y));
+                std::fill(row + span.left, row + span.right, background_);
+            }
+        }
+        previous_ = touched_;
+        touched_.fill(span_t());
+    }
+
+    // Fill the whole buffer with a colour, every row is marked as touched
+    constexpr void fill(Pf c) {
+        base_type::fill(c);
+        touched_.fill(span_t(0, static_cast<int>(W)));
+    }
+
+    template<typename DrawMode>
+    constexpr void plot_pixel(const int x, const int y, DrawMode mode, Pf color) {
+        if (x < this->width && x >= 0 && y < this->height && y >= 0) {
+            touched_[y].add(x);
+            mode(*this, (y * this->width) + x, color);
+        }
+    }
+
+    // Mark pixels [left, right) of row y as drawn, for code that writes to row() directly
+    constexpr void touch(const int y, const int left, const int right) {
+        touched_[y] = merge(touched_[y], span_t(left, right));
+    }
+
+    // The span of row y drawn since the last clear
+    constexpr const span_t &touched(const int y) const {
+        return touched_[y];
+    }
+
+    // The span of row y that has changed since the previous frame
+    constexpr span_t dirty(const int y) const {
+        return merge(touched_[y], previous_[y]);
+    }
+
+private:
+    Pf background_{};
+    spans_type touched_{};
+    spans_type previous_{};
+};
+
+/*
+ * Alpha blend the pixels of an ARGB overlay that were drawn since its last clear over dst, only the touched row
+ * spans are composited. See composite_row().
+ */
+template<size_t W, size_t H, typename PfDst>
+void composite(framebuffer<W, H, PfDst> &dst, const tracked_framebuffer<W, H, pf_argb_t> &overlay) {
+    for (int y = 0; y < static_cast<int>(H); y++) {
+        const auto &span = overlay.touched(y);
+        if (!span.empty()) {
+            composite_row(dst.row(y) + span.left, overlay.row(y) + span.left, static_cast<size_t>(span.width()));
+        }
+    }
+}
+
 /*
  * vectrex viewport voltage span
  */
@@ -659,6 +1322,119 @@ void draw_text(T &fb, int x, int y, const Pf &c, std::string message) {
     }
 }
 
+/*
+ * The font8x8_basic glyphs pre-rendered in one colour, for draw_text() with a preformatted buffer.
+ *
+ * Every glyph row is stored as a PIXEL_WIDTH pixel mask, so a row is drawn with a masked select of the whole row
+ * instead of a bit test and a bounds checked plot_pixel() per pixel. Build the atlas once and keep it, it is 128
+ * glyphs of PIXEL_WIDTH * PIXEL_HEIGHT masks.
+ */
+template<typename Pf>
+class glyph_atlas {
+public:
+    using value_type = typename std::remove_cv<decltype(Pf::value)>::type;
+    static_assert(std::is_integral<value_type>::value && sizeof(Pf) == sizeof(value_type),
+                  "glyph_atlas needs a packed integer pixel format");
+
+    static constexpr size_t GLYPHS = 128;
+
+    explicit glyph_atlas(const Pf colour) : colour_(colour.value) {
+        for (size_t c = 0; c < GLYPHS; c++) {
+            for (size_t y = 0; y < PIXEL_HEIGHT; y++) {
+                const auto bits = font8x8_basic[c][y];
+                bits_[c][y] = bits;
+                for (size_t x = 0; x < PIXEL_WIDTH; x++) {
+                    masks_[c][y][x] = (bits & (1u << x)) ? static_cast<value_type>(~value_type(0)) : value_type(0);
+                }
+            }
+        }
+    }
+
+    constexpr value_type colour() const {
+        return colour_;
+    }
+
+    // Bit x is set if pixel x of row y of the glyph is drawn
+    constexpr uint8_t bits(const char c, const int y) const {
+        return bits_[c & 0x7f][y];
+    }
+
+    // The pixel masks of row y of the glyph
+    constexpr const value_type *mask(const char c, const int y) const {
+        return masks_[c & 0x7f][y].data();
+    }
+
+    // Draw one glyph row of PIXEL_WIDTH pixels to dst
+    inline void blit_row(value_type *dst, const char c, const int y) const {
+        const value_type *m = mask(c, y);
+#ifdef VXGFX_SSE2
+        if (sizeof(value_type) == 4 || sizeof(value_type) == 2) {
+            const __m128i colour = (sizeof(value_type) == 4)
+                ? _mm_set1_epi32(static_cast<int32_t>(colour_)) : _mm_set1_epi16(static_cast<int16_t>(colour_));
+            constexpr size_t LANES = 16 / sizeof(value_type);
+            for (size_t x = 0; x < PIXEL_WIDTH; x += LANES) {
+                auto d = reinterpret_cast<__m128i *>(dst + x);
+                const __m128i mk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(m + x));
+                _mm_storeu_si128(d, _mm_or_si128(_mm_andnot_si128(mk, _mm_loadu_si128(d)), _mm_and_si128(mk, colour)));
+            }
+            return;
+        }
+#endif
+        for (size_t x = 0; x < PIXEL_WIDTH; x++) {
+            dst[x] = static_cast<value_type>((dst[x] & ~m[x]) | (colour_ & m[x]));
+        }
+    }
+
+private:
+    value_type colour_;
+    std::array<std::array<uint8_t, PIXEL_HEIGHT>, GLYPHS> bits_{};
+    std::array<std::array<std::array<value_type, PIXEL_WIDTH>, PIXEL_HEIGHT>, GLYPHS> masks_{};
+};
+
+/*
+ * Draw length characters of text with a glyph atlas, the glyphs overwrite the framebuffer (m_direct). Glyphs that are
+ * entirely inside the framebuffer are drawn a row at a time, glyphs on the edge are clipped pixel by pixel.
+ */
+template<typename T, typename Pf>
+void draw_text(T &fb, const glyph_atlas<Pf> &atlas, int x, const int y, const char *text, const size_t length) {
+    using value_type = typename glyph_atlas<Pf>::value_type;
+    const int width = static_cast<int>(fb.width);
+    const int height = static_cast<int>(fb.height);
+    const int left = x;
+    const bool rows_inside = y >= 0 && y + static_cast<int>(PIXEL_HEIGHT) <= height;
+
+    for (size_t i = 0; i < length; i++, x += PIXEL_WIDTH + PIXEL_SPACING) {
+        const char c = text[i];
+        if (rows_inside && x >= 0 && x + static_cast<int>(PIXEL_WIDTH) <= width) {
+            for (int y_pixel = 0; y_pixel < static_cast<int>(PIXEL_HEIGHT); y_pixel++) {
+                if (atlas.bits(c, y_pixel)) {
+                    atlas.blit_row(reinterpret_cast<value_type *>(fb.row(y + y_pixel) + x), c, y_pixel);
+                }
+            }
+        } else {
+            for (int y_pixel = 0; y_pixel < static_cast<int>(PIXEL_HEIGHT); y_pixel++) {
+                const auto bits = atlas.bits(c, y_pixel);
+                for (int x_pixel = 0; bits && x_pixel < static_cast<int>(PIXEL_WIDTH); x_pixel++) {
+                    const int px = x + x_pixel;
+                    const int py = y + y_pixel;
+                    if ((bits & (1u << x_pixel)) && px >= 0 && px < width && py >= 0 && py < height) {
+                        reinterpret_cast<value_type *>(fb.row(py))[px] = atlas.colour();
+                    }
+                }
+            }
+        }
+    }
+
+    // Report the drawn rectangle, clipped to the framebuffer
+    const int l = std::max(left, 0);
+    const int r = std::min(x - static_cast<int>(PIXEL_SPACING), width);
+    if (l < r) {
+        for (int py = std::max(y, 0); py < std::min(y + static_cast<int>(PIXEL_HEIGHT), height); py++) {
+            fb.touch(py, l, r);
+        }
+    }
+}
+
 inline rect_t intersect(const rect_t *a, const rect_t *b) {
 
     const point_t p0{
@@ -703,8 +1479,12 @@ struct transform {
     }
 };
 
+/*
+ * Copy the passepartout cutout of pfSrc to pfDst at offset, clipped to both framebuffers. The copy is done a row span
+ * at a time, row(dst, src, width) is called with pointers to the first pixel of each row.
+ */
 template<typename PfDst, typename PfSrc, typename Fn>
-void draw(PfDst &pfDst, point_t offset, PfSrc &pfSrc, const rect_t &passepartout, Fn draw) {
+void blit(PfDst &pfDst, point_t offset, PfSrc &pfSrc, const rect_t &passepartout, Fn row) {
 
     // Initialized in all branches so not needed here
     int px;
@@ -765,16 +1545,26 @@ void draw(PfDst &pfDst, point_t offset, PfSrc &pfSrc, const rect_t &passepartout
     auto rawDst = pfDst.data();
     auto rawSrc = pfSrc.data();
 
-    // Copy loop.
+    // Copy loop, the clipped destination starts at the top left of dstRect
     for (int y = 0; y < ph; y++) {
-        for (int x = 0; x < pw; x++) {
-            auto srcPos = ((y + py) * pfSrc.width) + (x + px);
-            auto dstPos = ((y + offset.y) * pfDst.width) + (x + offset.x);
-            draw(rawDst[dstPos], rawSrc[srcPos]);
-        }
+        auto srcPos = ((y + py) * pfSrc.width) + px;
+        auto dstPos = ((y + dstRect.top) * pfDst.width) + dstRect.left;
+        row(rawDst + dstPos, rawSrc + srcPos, pw);
     }
 }
 
+/*
+ * Per pixel version of blit(), draw(dst, src) is called for every pixel
+ */
+template<typename PfDst, typename PfSrc, typename Fn>
+void draw(PfDst &pfDst, point_t offset, PfSrc &pfSrc, const rect_t &passepartout, Fn draw) {
+    blit(pfDst, offset, pfSrc, passepartout, [&draw](auto *dst, const auto *src, int width) {
+        for (int x = 0; x < width; x++) {
+            draw(dst[x], src[x]);
+        }
+    });
+}
+
 } // namespace vxgfx
 
 #endif //VECTREXIA_GFXUTIL_H
@@ -17,9 +17,19 @@ You should have received a copy of the GNU General Public License
 along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <cstdio>
+#include <cstdarg>
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
+#include <cinttypes>
 #include <memory>
+#include <array>
+#include <bitset>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 #if _MSC_VER >= 1910 && !__INTEL_COMPILER
 #include "win32.h"
@@ -27,14 +37,99 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "libretro.h"
 #include "vectrexia.h"
+#include "rewindbuffer.h"
+#include "spscqueue.h"
+#include "perfcounters.h"
 
+constexpr int CPU_CLOCK = 1500000;
 constexpr int CYCLES_PER_FRAME = 30000;
 unsigned long cycles_per_frame = CYCLES_PER_FRAME;
+// End the frames when the game refreshes the screen, instead of every CYCLES_PER_FRAME
+bool refresh_sync = false;
+double frame_rate = 50.0;       // the frame rate the frontend was told
+double refresh_rate = 50.0;     // the refresh rate of the game, and the number of frames it has held for
+unsigned refresh_frames = 0;
+bool debug_overlay = false;
+unsigned audio_rate = AY38910::DEFAULT_SAMPLE_RATE;
 std::unique_ptr<Vectrex> vectrex = std::make_unique<Vectrex>();
 vxgfx::framebuffer<FRAME_WIDTH, FRAME_HEIGHT, vxgfx::pf_rgb565_t> out_buffer{};
+bool out_buffer_stale = false;   // out_buffer missed frames that were rendered into the frontend's framebuffer
+std::array<int16_t, 2 * 2048> audio_buffer{};  // interleaved stereo frames, a frame at 96kHz fits
+size_t state_size = 0;          // see retro_serialize_size()
+unsigned runahead_frames = 0;
+std::vector<uint8_t> runahead_state;  // the end of the frame that was run, while the frames ahead are run
+// While the frontend fast-forwards, the frames in between the ones shown are only emulated, they are neither drawn
+// nor heard
+unsigned fastforward_skip = 3;
+unsigned fastforward_frame = 0;
+
+// Rewind, while L is held on the first controller. The checkpoints leave out the screen, they are a few KB and only
+// differ by a few hundred bytes, so the buffer holds minutes of checkpoints.
+constexpr size_t REWIND_BUFFER_SIZE = 8 << 20;
+constexpr size_t REWIND_CHECKPOINTS = 16384;
+std::unique_ptr<RewindBuffer> rewind_buffer;
+unsigned rewind_interval = 1;   // frames between checkpoints
+unsigned rewind_frame = 0;
+std::vector<uint8_t> rewind_state;
+
+// The RAM handed to the frontend, for achievements and cheats. With the thread the Vectrex's RAM is written while the
+// frontend reads it, so the frontend is given a copy instead, with or without the thread: the RAM is published at the
+// end of each frame that is submitted, and after a game or a state is loaded or the Vectrex is reset. The bytes the
+// frontend wrote since are written to the Vectrex's RAM with the controls for the next frame that is run. With the
+// thread that is the frame after the one submitted, so a byte the frontend wrote reads back as it was for a frame.
+std::array<uint8_t, 1024> shared_ram{};     // the Vectrex's 1K of RAM, as the frontend sees it
+std::array<uint8_t, 1024> published_ram{};  // the RAM that was last published, to find what the frontend wrote
+
+// The controls for a frame
+struct frame_input_t
+{
+    uint8_t p1_x, p1_y, p1_b1, p1_b2, p1_b3, p1_b4;
+    uint8_t p2_x, p2_y, p2_b1, p2_b2, p2_b3, p2_b4;
+    bool mute[3];
+    bool audio;     // the frame is heard
+    bool video;     // the frame is drawn
+    std::array<uint8_t, 1024> ram;  // the RAM the frontend wrote, the bytes in ram_written
+    std::bitset<1024> ram_written;
+};
+
+// Threaded emulation. The Vectrex runs on a thread of its own, retro_run hands it the controls for the next frame and
+// submits the frame before it, which the thread finished while the frontend was busy. Each frame is still run with the
+// controls read for it and in the same order, so the video and audio are the same as without the thread, a frame
+// later. The thread only touches the Vectrex between taking the controls of a frame and counting it as done, so the
+// frontend's thread waits for it to catch up (sync_thread()) before it uses the Vectrex itself. Run-ahead and rewind
+// work on the state between frames, they are not used with the thread.
+struct frame_output_t
+{
+    vxgfx::framebuffer<FRAME_WIDTH, FRAME_HEIGHT, vxgfx::pf_rgb565_t> video;
+    std::array<int16_t, 2 * 4096> audio{};  // interleaved stereo frames, two frames at 96kHz fit
+    size_t samples = 0;
+    bool drawn = false;
+    uint64_t refresh_period = 0;
+    std::array<uint8_t, 1024> ram{};  // the RAM at the end of the frame
+};
+
+constexpr size_t THREAD_FRAMES = 4;
+bool threaded = false;
+std::thread emulation_thread;
+std::atomic<bool> thread_quit{false};
+SPSCQueue<frame_input_t, THREAD_FRAMES> thread_input;       // the mailbox for the controls
+SPSCQueue<frame_output_t *, THREAD_FRAMES> thread_output;   // finished frames
+SPSCQueue<frame_output_t *, THREAD_FRAMES> thread_free;     // frames that were submitted, to be drawn into again
+std::array<std::unique_ptr<frame_output_t>, THREAD_FRAMES> thread_frames;
+std::atomic<uint64_t> thread_done{0};
+uint64_t thread_posted = 0;      // frames handed to the thread
+uint64_t thread_submitted = 0;   // frames submitted to the frontend, or dropped
+
+// Frame timings, logged every second while enabled. They are added to the frontend's performance counters too, which
+// it logs itself.
+std::unique_ptr<PerfCounters> perf;
+std::array<retro_perf_counter, PerfCounters::SECTIONS> perf_counters{};
+std::chrono::steady_clock::time_point perf_logged;
+unsigned perf_frames = 0;
 
 // Callbacks
 static retro_log_printf_t log_cb;
+static struct retro_perf_callback perf_cb;
 static retro_video_refresh_t video_cb;
 static retro_input_poll_t input_poll_cb;
 static retro_input_state_t input_state_cb;
@@ -45,6 +140,22 @@ static retro_audio_sample_batch_t audio_batch_cb;
 unsigned retro_api_version(void) { return RETRO_API_VERSION; }
 
 static void update_variables(void);
+static void set_memory_maps(void);
+static size_t save_state(std::vector<uint8_t> &buffer, bool screen);
+static uint64_t run_frame(void);
+static void apply_input(const frame_input_t &input);
+static void read_frontend_ram(frame_input_t &input);
+static void publish_ram(const uint8_t *ram);
+static void update_frame_rate(uint64_t refresh_period);
+static void run_audio(bool enabled);
+static void run_video(uint64_t cycles_run);
+static void skip_video(void);
+static void run_threaded(const frame_input_t &input);
+static void sync_thread(void);
+static void stop_thread(void);
+static void drop_thread_frames(void);
+static void set_perf_log(bool enabled);
+static void update_perf(void);
 
 // Cheats
 void retro_cheat_reset(void) {}
@@ -86,18 +197,31 @@ bool retro_load_game(const struct retro_game_info *info)
 
     // Reset the Vectrex, clears the cart ROM and loads the System ROM
     vectrex->Reset();
+    if (rewind_buffer)
+        rewind_buffer->Clear();
 
+    bool loaded = true;
     if (info && info->data) { // ensure there is ROM data
-        return vectrex->LoadCartridge((const uint8_t*)info->data, info->size);
+        loaded = vectrex->LoadCartridge((const uint8_t*)info->data, info->size);
+    }
+    else if (info && info->path) { // or map the ROM file
+        loaded = vectrex->LoadCartridge(RomImage::Map(info->path));
     }
 
-    return true;
+    state_size = 0;
+    publish_ram(vectrex->GetRAM());
+    set_memory_maps();
+    return loaded;
 }
 
 bool retro_load_game_special(unsigned game_type, const struct retro_game_info *info, size_t num_info) { return false; }
 
 // Unload the cartridge
-void retro_unload_game(void) { vectrex->UnloadCartridge(); }
+void retro_unload_game(void)
+{
+    stop_thread();
+    vectrex->UnloadCartridge();
+}
 
 unsigned retro_get_region(void) { return RETRO_REGION_PAL; }
 
@@ -105,22 +229,94 @@ unsigned retro_get_region(void) { return RETRO_REGION_PAL; }
 void retro_set_controller_port_device(unsigned port, unsigned device) {}
 
 
-void *retro_get_memory_data(unsigned id) { return nullptr; }
-size_t retro_get_memory_size(unsigned id){ return 0; }
+// The copy of the RAM is handed out, see shared_ram, it is never moved
+void *retro_get_memory_data(unsigned id)
+{
+    return (id == RETRO_MEMORY_SYSTEM_RAM) ? shared_ram.data() : nullptr;
+}
+
+size_t retro_get_memory_size(unsigned id)
+{
+    return (id == RETRO_MEMORY_SYSTEM_RAM) ? shared_ram.size() : 0;
+}
+
+// Describe the memory the CPU sees to the frontend, for achievements and cheats. A cartridge with a single bank is
+// mapped at 0000-7FFF. The bank of a larger cartridge changes while it runs, so the whole image is mapped above the
+// 64K the CPU sees instead, at the first power of two that holds it, so that it does not overlap the RAM or the BIOS.
+static void set_memory_maps(void)
+{
+    static std::array<retro_memory_descriptor, 3> descriptors;
+    unsigned count = 0;
+
+    descriptors[count++] = { 0, shared_ram.data(), 0, 0xc800, 0xf800, 0, shared_ram.size(), nullptr };
+    descriptors[count++] = { RETRO_MEMDESC_CONST, const_cast<uint8_t *>(vectrex->GetSystemROM()), 0, 0xe000, 0xe000,
+                             0, 0x2000, nullptr };
+
+    const auto &cartridge = vectrex->cartridge_;
+    if (cartridge && cartridge->is_loaded()) {
+        auto *rom = const_cast<uint8_t *>(cartridge->image()->data());
+        if (cartridge->banks() == 1) {
+            descriptors[count++] = { RETRO_MEMDESC_CONST, rom, 0, 0x0000, 0x8000, 0, 0x8000, nullptr };
+        } else {
+            // the image is at [start, 2 * start), select matches the address bits above that
+            const size_t size = cartridge->image()->size();
+            size_t start = 0x10000;
+            while (start < size)
+                start <<= 1;
+            descriptors[count++] = { RETRO_MEMDESC_CONST, rom, 0, start, ~(start - 1), 0, size, "CART" };
+        }
+    }
+
+    retro_memory_map map = { descriptors.data(), count };
+    environ_cb(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, &map);
+}
 
 // Serialisation methods
-size_t retro_serialize_size(void) { return 0; }
-bool retro_serialize(void *data, size_t size) { return false; }
-bool retro_unserialize(const void *data, size_t size) { return false; }
+// The size of a state changes with the number of vectors on screen, but frontends ask for the size once and expect
+// it to stay the same (eg. for rewind and run-ahead), so the largest size a state can be is reported. It is worked
+// out again for each game.
+
+size_t retro_serialize_size(void)
+{
+    sync_thread();
+    if (!state_size)
+        state_size = vectrex->MaxStateSize();
+    return state_size;
+}
+
+bool retro_serialize(void *data, size_t size)
+{
+    sync_thread();
+    return vectrex->SaveState(data, size) != 0;
+}
+
+// The frames the thread finished before the state was loaded are not shown
+bool retro_unserialize(const void *data, size_t size)
+{
+    sync_thread();
+    drop_thread_frames();
+    const bool loaded = vectrex->LoadState(data, size);
+    publish_ram(vectrex->GetRAM());
+    return loaded;
+}
 
 // End of retrolib
-void retro_deinit(void) { }
+void retro_deinit(void) { stop_thread(); }
 
 // libretro global setters
 void retro_set_environment(retro_environment_t cb) {
   environ_cb = cb;
 
   struct retro_variable variables[] = {
+      { "vectrexia_debug_overlay", "Debug overlay; disabled|enabled" },
+      { "vectrexia_audio_rate", "Audio sample rate; 44100|48000|96000" },
+      { "vectrexia_frame_timing", "Frame timing; fixed|game refresh" },
+      { "vectrexia_runahead", "Run-ahead frames; 0|1|2|3" },
+      { "vectrexia_rewind", "Rewind (hold L); disabled|enabled" },
+      { "vectrexia_rewind_interval", "Rewind checkpoint interval (frames); 1|2|5|10" },
+      { "vectrexia_fastforward_skip", "Fast-forward frame skip; 3|1|7|15|0" },
+      { "vectrexia_perf_log", "Log frame timings; disabled|enabled" },
+      { "vectrexia_threaded", "Threaded emulation (a frame of latency); disabled|enabled" },
 #ifdef VECTREXIA_DEBUG
       { "vectrexia_internal_slowdown", "Internal Slowdown; 1x|2x|5x|10x|20x|50x|100x|1000x|10000x|30000x" },
 #endif
@@ -132,7 +328,7 @@ void retro_set_environment(retro_environment_t cb) {
   cb(RETRO_ENVIRONMENT_SET_VARIABLES, variables);
 }
 
-void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) {}
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) { audio_batch_cb = cb; }
 void retro_set_video_refresh(retro_video_refresh_t cb) { video_cb = cb; }
 void retro_set_audio_sample(retro_audio_sample_t cb) { audio_cb = cb; }
 void retro_set_input_poll(retro_input_poll_t cb) { input_poll_cb = cb; }
@@ -177,8 +373,8 @@ void retro_get_system_av_info(struct retro_system_av_info *info) {
     int pixel_format = RETRO_PIXEL_FORMAT_RGB565;
 
     memset(info, 0, sizeof(retro_system_av_info));
-    info->timing.fps            = 50.0;
-    info->timing.sample_rate    = 44100.0;
+    info->timing.fps            = frame_rate;
+    info->timing.sample_rate    = audio_rate;
     info->geometry.base_width   = FRAME_WIDTH;
     info->geometry.base_height  = FRAME_HEIGHT;
     info->geometry.max_width    = FRAME_WIDTH;
@@ -192,7 +388,9 @@ void retro_get_system_av_info(struct retro_system_av_info *info) {
 // Reset the Vectrex
 void retro_reset(void)
 {
+    sync_thread();
     vectrex->Reset();
+    publish_ram(vectrex->GetRAM());
 }
 
 // Test the user input and return the state of the joysticks and buttons
@@ -223,79 +421,595 @@ void get_joystick_state(unsigned port, uint8_t &x, uint8_t &y, uint8_t &b1, uint
     b4 = (unsigned char) (input_state_cb(port, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_Y ) ? 1 : 0);
 }
 
-static const auto green = vxgfx::pf_argb_t(255, 255, 0, 128 );
+static const auto green = vxgfx::pf_argb_t(0xc0, 0x00, 0xff, 0x00);
+
+// Print a line of debugging text to the debug overlay
+static void debug_print(DebugBuffer &db, int x, int y, const char *fmt, ...)
+{
+    static const vxgfx::glyph_atlas<vxgfx::pf_argb_t> font(green);
+
+    char line[64];
+    va_list args;
+    va_start(args, fmt);
+    const int length = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    if (length > 0)
+        vxgfx::draw_text(db, font, x, y, line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+}
+
+// fb => out_buffer conversion, only the parts of the frame that were drawn this frame or the last need converting.
+// The parts that the debug overlay covered last frame are converted again to remove it.
+static void render_out_buffer(const VectorBuffer &fb, const DebugBuffer &db)
+{
+    for (int y = 0; y < FRAME_HEIGHT; y++) {
+        auto span = out_buffer_stale ? vxgfx::span_t(0, FRAME_WIDTH) : vxgfx::merge(fb.dirty(y), db.dirty(y));
+        if (!span.empty()) {
+            vxgfx::convert_row(fb.row(y) + span.left, out_buffer.row(y) + span.left, span.width());
+        }
+    }
+    out_buffer_stale = false;
+
+    vxgfx::composite(out_buffer, db);
+}
+
+// fb => frontend framebuffer conversion. The frontend may hand out a different buffer every frame and its contents
+// are unspecified, so every pixel is written: the span of each row drawn this frame is converted and the rest of the
+// row is cleared to the (black) background.
+template<typename PfOut>
+static void render_frame(const VectorBuffer &fb, const DebugBuffer &db, void *data, size_t pitch)
+{
+    const PfOut black(0, 0, 0);
+    for (int y = 0; y < FRAME_HEIGHT; y++) {
+        auto out = reinterpret_cast<PfOut *>(static_cast<uint8_t *>(data) + y * pitch);
+        const auto &span = fb.touched(y);
+        if (span.empty()) {
+            std::fill(out, out + FRAME_WIDTH, black);
+        } else {
+            std::fill(out, out + span.left, black);
+            vxgfx::convert_row(fb.row(y) + span.left, out + span.left, span.width());
+            std::fill(out + span.right, out + FRAME_WIDTH, black);
+        }
+
+        const auto &overlay = db.touched(y);
+        if (!overlay.empty()) {
+            vxgfx::composite_row(out + overlay.left, db.row(y) + overlay.left, overlay.width());
+        }
+    }
+    out_buffer_stale = true;
+}
 
 // Run a single frames with out Vectrex emulation.
 void retro_run(void)
 {
     bool updated = false;
-    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
+    if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated) {
+      // the thread uses the settings while it runs a frame
+      sync_thread();
+      const auto rate = audio_rate;
       update_variables();
 
+      // tell the frontend about the new sample rate
+      if (audio_rate != rate) {
+        struct retro_system_av_info info;
+        retro_get_system_av_info(&info);
+        environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+      }
+    }
+
     // User input
     input_poll_cb();
 
-    uint8_t p1_x, p1_y, p2_x, p2_y;
-    uint8_t p1_b1, p1_b2, p1_b3, p1_b4, p2_b1, p2_b2, p2_b3, p2_b4;
+    frame_input_t input;
+    get_joystick_state(0, input.p1_x, input.p1_y, input.p1_b1, input.p1_b2, input.p1_b3, input.p1_b4);
+    get_joystick_state(1, input.p2_x, input.p2_y, input.p2_b1, input.p2_b2, input.p2_b3, input.p2_b4);
+
+    input.mute[0] = input_state_cb(0, RETRO_DEVICE_KEYBOARD, 0, RETROK_1) != 0;
+    input.mute[1] = input_state_cb(0, RETRO_DEVICE_KEYBOARD, 0, RETROK_2) != 0;
+    input.mute[2] = input_state_cb(0, RETRO_DEVICE_KEYBOARD, 0, RETROK_3) != 0;
+
+    int av_enable = 3;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+        av_enable = 3;
+
+    // only one frame in fastforward_skip + 1 is presented while fast-forwarding
+    bool fastforward = false;
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_FASTFORWARDING, &fastforward))
+        fastforward = false;
+    bool shown = true;
+    if (fastforward && fastforward_frame++ < fastforward_skip)
+        shown = false;
+    else
+        fastforward_frame = 0;
 
-    // updates the p1_* variables
-    get_joystick_state(0, p1_x, p1_y, p1_b1, p1_b2, p1_b3, p1_b4);
-    get_joystick_state(1, p2_x, p2_y, p2_b1, p2_b2, p2_b3, p2_b4);
+    input.audio = shown && (av_enable & 2);
+    input.video = shown && (av_enable & 1);
+    read_frontend_ram(input);
 
-    vectrex->SetPlayerOne(p1_x, p1_y, p1_b1, p1_b2, p1_b3, p1_b4);
-    vectrex->SetPlayerTwo(p2_x, p2_y, p2_b1, p2_b2, p2_b3, p2_b4);
+    if (threaded) {
+        run_threaded(input);
+        return;
+    }
+    apply_input(input);
+
+    // Go back to the last checkpoint and run the frame from there, silently
+    const bool rewinding = rewind_buffer && input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L);
+    if (rewinding) {
+        size_t size;
+        const uint8_t *state = rewind_buffer->Rewind(size);
+        if (state)
+            vectrex->LoadState(state, size);
+    }
 
-    vectrex->psg_->channel_a_on = !input_state_cb(0, RETRO_DEVICE_KEYBOARD, 0, RETROK_1);
-    vectrex->psg_->channel_b_on = !input_state_cb(0, RETRO_DEVICE_KEYBOARD, 0, RETROK_2);
-    vectrex->psg_->channel_c_on = !input_state_cb(0, RETRO_DEVICE_KEYBOARD, 0, RETROK_3);
+    auto cycles_run = run_frame();
+    run_audio(input.audio && !rewinding);
+    update_frame_rate(vectrex->RefreshPeriod());
+
+    // Run-ahead: the game only reads the controls once a frame, so what it shows lags the input by a frame. The frame
+    // is kept and the following frames are run with the same input, only the last one is drawn, and then the frame
+    // that was kept is restored. The frames in between are neither drawn nor heard, but they are still emulated in
+    // full, vectorizer included: a vector lasts decay_cycles, longer than a frame, so the frames before the last one
+    // add to what it shows.
+    bool ahead = false;
+    if (runahead_frames && input.video) {
+        vectrex->SkipFramebuffer();
+        ahead = save_state(runahead_state, true) != 0;
+    }
+    for (unsigned frame = 0; ahead && frame < runahead_frames; frame++) {
+        cycles_run = run_frame();
+        vectrex->psg_->Skip(vectrex->cycles);
+        if (frame + 1 < runahead_frames)
+            vectrex->SkipFramebuffer();
+    }
+
+    if (input.video)
+        run_video(cycles_run);
+    else
+        skip_video();
+
+    if (ahead)
+        vectrex->LoadState(runahead_state.data(), runahead_state.size());
+
+    if (rewind_buffer && !rewinding && ++rewind_frame >= rewind_interval) {
+        rewind_frame = 0;
+        const size_t size = save_state(rewind_state, false);
+        if (size)
+            rewind_buffer->Push(rewind_state.data(), size);
+    }
+
+    publish_ram(vectrex->GetRAM());
+    update_perf();
+}
+
+// Vectrex CPU is 1.5MHz (1500000) and at 50 fps, a frame lasts 20ms, therefore in every frame 30,000 cycles happen.
+// Games refresh the screen at their own rate though, the BIOS default is 50Hz, so a fixed frame can end in the middle
+// of drawing. Synced to the refresh, a frame lasts until the game starts its next refresh, or two frames if it does not.
+static uint64_t run_frame(void)
+{
+    if (refresh_sync)
+        return vectrex->RunFrame(2 * cycles_per_frame, true);
+    return vectrex->RunFrame(cycles_per_frame);
+}
+
+static void apply_input(const frame_input_t &input)
+{
+    vectrex->SetPlayerOne(input.p1_x, input.p1_y, input.p1_b1, input.p1_b2, input.p1_b3, input.p1_b4);
+    vectrex->SetPlayerTwo(input.p2_x, input.p2_y, input.p2_b1, input.p2_b2, input.p2_b3, input.p2_b4);
+
+    for (int channel = 0; channel < 3; channel++)
+        vectrex->psg_->SetChannelMute(channel, input.mute[channel]);
+
+    if (input.ram_written.any()) {
+        auto *ram = vectrex->GetRAM();
+        for (size_t n = 0; n < input.ram.size(); n++)
+            if (input.ram_written[n])
+                ram[n] = input.ram[n];
+    }
+}
+
+// The bytes the frontend wrote to its copy of the RAM since it was published
+static void read_frontend_ram(frame_input_t &input)
+{
+    input.ram = shared_ram;
+    for (size_t n = 0; n < shared_ram.size(); n++)
+        input.ram_written[n] = shared_ram[n] != published_ram[n];
+}
 
-    // Vectrex CPU is 1.5MHz (1500000) and at 50 fps, a frame lasts 20ms, therefore in every frame 30,000 cycles happen.
-    auto cycles_run = vectrex->Run(cycles_per_frame);
+// Hand the frontend the RAM at the end of a frame, what it wrote before is replaced
+static void publish_ram(const uint8_t *ram)
+{
+    std::copy(ram, ram + shared_ram.size(), shared_ram.begin());
+    published_ram = shared_ram;
+}
+
+// Tell the frontend the new frame rate once the game has held a different refresh rate for a few frames
+static void update_frame_rate(uint64_t refresh_period)
+{
+    double rate = 50.0;
+    if (refresh_sync && refresh_period)
+        rate = (double) CPU_CLOCK / refresh_period;
+    if (rate < 20.0 || rate > 100.0)
+        return;
+
+    if (std::fabs(rate - refresh_rate) > 0.5) {
+        refresh_rate = rate;
+        refresh_frames = 0;
+    } else if (++refresh_frames == 8 && std::fabs(refresh_rate - frame_rate) > 0.5) {
+        frame_rate = refresh_rate;
+        struct retro_system_av_info info;
+        retro_get_system_av_info(&info);
+        environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+    }
+}
 
+// Save the state into buffer and return its size, the buffer grows to fit with room to spare
+static size_t save_state(std::vector<uint8_t> &buffer, bool screen)
+{
+    size_t size = buffer.empty() ? 0 : vectrex->SaveState(buffer.data(), buffer.size(), screen);
+    if (!size) {
+        const size_t needed = vectrex->SaveState(nullptr, 0, screen);
+        buffer.resize(needed + needed / 2);
+        size = vectrex->SaveState(buffer.data(), buffer.size(), screen);
+    }
+    return size;
+}
+
+// Render the audio up to the end of the frame, 882 samples at 44.1kHz and 50 fps, the count follows the cycles that
+// were run so it can vary from frame to frame. If the frontend does not want the audio the PSG only catches up with
+// the emulation.
+static void run_audio(bool enabled)
+{
+    PerfCounters::Timer timer(perf.get(), PerfCounters::AUDIO);
+    if (enabled) {
+        vectrex->psg_->Render(vectrex->cycles);
+
+        // mono sound, the same data for both channels, submitted in one batch
+        size_t count;
+        while ((count = vectrex->psg_->ReadSamples(audio_buffer.data(), audio_buffer.size() / 2, 2)) > 0) {
+            audio_batch_cb(audio_buffer.data(), count);
+        }
+    } else {
+        vectrex->psg_->Skip(vectrex->cycles);
+    }
+}
+
+// Print sound debugging text
+static void print_debug_overlay(DebugBuffer &db, uint64_t cycles_run)
+{
+    debug_print(db, 2, 10, "@ %.fHz", (double)(cycles_run * 50));
+    debug_print(db, 2, 20, "Channel A: %3.0fHz (noise: %d)", vectrex->psg_->channel_a.frequency_, vectrex->psg_->channel_a.noise_enabled);
+    debug_print(db, 2, 30, "Channel B: %3.0fHz (noise: %d)", vectrex->psg_->channel_b.frequency_, vectrex->psg_->channel_b.noise_enabled);
+    debug_print(db, 2, 40, "Channel C: %3.0fHz (noise: %d)", vectrex->psg_->channel_c.frequency_, vectrex->psg_->channel_c.noise_enabled);
+}
+
+// Draw the frame and hand it to the frontend
+static void run_video(uint64_t cycles_run)
+{
     // Get buffers
     auto fb = vectrex->getFramebuffer();
     auto db = vectrex->getDebugbuffer();
 
-    // Print sound debugging text
-    vxgfx::draw_text<vxgfx::m_direct>(*db, 2, 10, green, vxl::format("@ %.fHz", (double)(cycles_run * 50)));
-    vxgfx::draw_text<vxgfx::m_direct>(*db, 2, 20, green, vxl::format("Channel A: %3.0fHz (noise: %d)", vectrex->psg_->channel_a.frequency_, vectrex->psg_->channel_a.noise_enabled));
-    vxgfx::draw_text<vxgfx::m_direct>(*db, 2, 30, green, vxl::format("Channel B: %3.0fHz (noise: %d)", vectrex->psg_->channel_b.frequency_, vectrex->psg_->channel_b.noise_enabled));
-    vxgfx::draw_text<vxgfx::m_direct>(*db, 2, 40, green, vxl::format("Channel C: %3.0fHz (noise: %d)", vectrex->psg_->channel_c.frequency_, vectrex->psg_->channel_c.noise_enabled));
+    if (debug_overlay)
+        print_debug_overlay(*db, cycles_run);
 
+    // Render straight into the frontend's framebuffer when it offers one in a format we can convert to, saving a
+    // full frame copy, otherwise render into out_buffer
+    struct retro_framebuffer frame = {};
+    frame.width = FRAME_WIDTH;
+    frame.height = FRAME_HEIGHT;
+    frame.access_flags = RETRO_MEMORY_ACCESS_WRITE | (debug_overlay ? RETRO_MEMORY_ACCESS_READ : 0);
 
-    // Define the pf_mono_t => pf_rgb565_t transform
-    auto mono_to_rgb565 = [](const vxgfx::pf_mono_t &p) {
-        return vxgfx::pf_rgb565_t(static_cast<uint8_t>(0xff * p.value),
-                                  static_cast<uint8_t>(0xff * p.value),
-                                  static_cast<uint8_t>(0xff * p.value));
-    };
+    const void *video_data = out_buffer.data();
+    size_t video_pitch = sizeof(vxgfx::pf_rgb565_t) * FRAME_WIDTH;
 
-    // fb => out_buffer transform
-    std::transform(fb->begin(), fb->end(), out_buffer.begin(), mono_to_rgb565);
+    const bool offered = environ_cb(RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER, &frame) && frame.data;
+    {
+        PerfCounters::Timer timer(perf.get(), PerfCounters::CONVERT);
+        if (offered && frame.format == RETRO_PIXEL_FORMAT_RGB565) {
+            render_frame<vxgfx::pf_rgb565_t>(*fb, *db, frame.data, frame.pitch);
+            video_data = frame.data;
+            video_pitch = frame.pitch;
+        } else if (offered && frame.format == RETRO_PIXEL_FORMAT_XRGB8888) {
+            render_frame<vxgfx::pf_argb_t>(*fb, *db, frame.data, frame.pitch);
+            video_data = frame.data;
+            video_pitch = frame.pitch;
+        } else {
+            render_out_buffer(*fb, *db);
+        }
+    }
 
-    // TODO
-    // some blending of db on top of out_buffer
+    // The debug overlay is drawn again every frame
+    db->clear();
 
-    // 882 audio samples per frame (44.1kHz @ 50 fps)
-    uint8_t buffer[882];
-    vectrex->psg_->FillBuffer(buffer, sizeof(buffer));
+    video_cb(video_data, FRAME_WIDTH, FRAME_HEIGHT, video_pitch);
+}
+
+// End the frame without drawing it, the frontend shows the last frame again
+static void skip_video(void)
+{
+    vectrex->SkipFramebuffer();
+    video_cb(nullptr, FRAME_WIDTH, FRAME_HEIGHT, 0);
+}
+
+// Nanoseconds, when the frontend has no performance counter
+static uint64_t steady_ticks(void)
+{
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void set_perf_log(bool enabled)
+{
+    if (!enabled) {
+        vectrex->SetPerfCounters(nullptr);
+        perf.reset();
+        return;
+    }
+    if (perf)
+        return;
+
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf_cb))
+        perf_cb = {};
+    perf = std::make_unique<PerfCounters>(perf_cb.get_perf_counter ? perf_cb.get_perf_counter : steady_ticks);
+
+    for (int section = 0; section < PerfCounters::SECTIONS; section++) {
+        auto &counter = perf_counters[section];
+        if (perf_cb.perf_register && !counter.registered) {
+            counter.ident = PerfCounters::Name((PerfCounters::section_t) section);
+            perf_cb.perf_register(&counter);
+        }
+    }
+
+    vectrex->SetPerfCounters(perf.get());
+    perf_logged = std::chrono::steady_clock::now();
+    perf_frames = 0;
+}
+
+// Called at the end of every frame, by the thread that ran it. Once a second the timings are added to the frontend's
+// counters and logged, each section as a share of the time that was timed.
+static void update_perf(void)
+{
+    if (!perf)
+        return;
+
+    perf_frames++;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - perf_logged < std::chrono::seconds(1))
+        return;
+
+    uint64_t total = 0;
+    for (int section = 0; section < PerfCounters::SECTIONS; section++)
+        total += perf->Total((PerfCounters::section_t) section);
+
+    char line[256];
+    size_t length = 0;
+    for (int section = 0; section < PerfCounters::SECTIONS; section++) {
+        const auto id = (PerfCounters::section_t) section;
+        perf_counters[section].total += perf->Total(id);
+        perf_counters[section].call_cnt += perf->Calls(id);
+        length += snprintf(line + length, sizeof(line) - length, " %s %.1f%%", PerfCounters::Name(id),
+                           total ? 100.0 * perf->Total(id) / total : 0.0);
+    }
+
+    if (log_cb)
+        log_cb(RETRO_LOG_INFO, "[vectrexia]: %u frames, %" PRIu64 " ticks a frame:%s\n", perf_frames,
+               total / perf_frames, line);
+
+    perf->Reset();
+    perf_frames = 0;
+    perf_logged = now;
+}
+
+// Wait for the other thread, spinning for a moment before sleeping
+template<typename F>
+static void wait_for(F ready)
+{
+    for (unsigned spins = 0; !ready(); spins++) {
+        if (spins < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// The emulation thread: run a frame for each set of controls and draw it into a free frame
+static void run_emulation_thread(void)
+{
+    for (;;) {
+        frame_input_t input;
+        wait_for([&] { return thread_quit.load(std::memory_order_acquire) || thread_input.pop(input); });
+        if (thread_quit.load(std::memory_order_acquire))
+            return;
+
+        frame_output_t *out = nullptr;
+        wait_for([&] { return thread_free.pop(out); });
+
+        apply_input(input);
+        const auto cycles_run = run_frame();
+
+        out->samples = 0;
+        {
+            PerfCounters::Timer timer(perf.get(), PerfCounters::AUDIO);
+            if (input.audio) {
+                vectrex->psg_->Render(vectrex->cycles);
+                out->samples = vectrex->psg_->ReadSamples(out->audio.data(), out->audio.size() / 2, 2);
+            } else {
+                vectrex->psg_->Skip(vectrex->cycles);
+            }
+        }
+        out->refresh_period = vectrex->RefreshPeriod();
+        std::copy(vectrex->GetRAM(), vectrex->GetRAM() + out->ram.size(), out->ram.begin());
+
+        out->drawn = input.video;
+        if (input.video) {
+            auto fb = vectrex->getFramebuffer();
+            auto db = vectrex->getDebugbuffer();
+            if (debug_overlay)
+                print_debug_overlay(*db, cycles_run);
+            PerfCounters::Timer timer(perf.get(), PerfCounters::CONVERT);
+            render_frame<vxgfx::pf_rgb565_t>(*fb, *db, out->video.data(), sizeof(vxgfx::pf_rgb565_t) * FRAME_WIDTH);
+            db->clear();
+        } else {
+            vectrex->SkipFramebuffer();
+        }
+        update_perf();
+
+        thread_output.push(out);
+        thread_done.fetch_add(1, std::memory_order_release);
+    }
+}
+
+static void start_thread(void)
+{
+    if (emulation_thread.joinable())
+        return;
+
+    if (!thread_frames[0]) {
+        for (auto &frame : thread_frames) {
+            frame = std::make_unique<frame_output_t>();
+            thread_free.push(frame.get());
+        }
+    }
+    // the checkpoints would skip the frames that were run on the thread
+    if (rewind_buffer)
+        rewind_buffer->Clear();
+
+    emulation_thread = std::thread(run_emulation_thread);
+}
+
+// Wait for the thread to finish the frames it was given, it then leaves the Vectrex alone until it is given another
+static void sync_thread(void)
+{
+    if (emulation_thread.joinable())
+        wait_for([] { return thread_done.load(std::memory_order_acquire) == thread_posted; });
+}
+
+// The thread is stopped between frames, the frames it finished are not shown
+static void stop_thread(void)
+{
+    if (!emulation_thread.joinable())
+        return;
+
+    sync_thread();
+    thread_quit.store(true, std::memory_order_release);
+    emulation_thread.join();
+    thread_quit.store(false, std::memory_order_relaxed);
+    drop_thread_frames();
+}
+
+// Hand the frames the thread finished back to it without submitting them, the thread must be idle
+static void drop_thread_frames(void)
+{
+    frame_output_t *frame = nullptr;
+    while (thread_output.pop(frame))
+        thread_free.push(frame);
+    thread_submitted = thread_posted;
+}
+
+// Give the thread the controls for this frame and submit the frame before it. The first frame has nothing before it,
+// the frontend is asked to show the last frame again.
+static void run_threaded(const frame_input_t &input)
+{
+    start_thread();
+    wait_for([&] { return thread_input.push(input); });
+    thread_posted++;
 
-    for (unsigned char i : buffer) {
-        auto convs = static_cast<short>((i << 8u) - 0x7ffu);
-        // mono sound, same data for both channels
-        audio_cb(convs, convs);
+    if (thread_posted - thread_submitted < 2) {
+        video_cb(nullptr, FRAME_WIDTH, FRAME_HEIGHT, 0);
+        return;
     }
-    
-    video_cb(reinterpret_cast<const uint16_t*>(out_buffer.data()),
-        FRAME_WIDTH, FRAME_HEIGHT, sizeof(unsigned short) * FRAME_WIDTH);
+
+    frame_output_t *frame = nullptr;
+    wait_for([&] { return thread_output.pop(frame); });
+    thread_submitted++;
+
+    publish_ram(frame->ram.data());
+    update_frame_rate(frame->refresh_period);
+    if (frame->samples)
+        audio_batch_cb(frame->audio.data(), frame->samples);
+    if (frame->drawn)
+        video_cb(frame->video.data(), FRAME_WIDTH, FRAME_HEIGHT, sizeof(vxgfx::pf_rgb565_t) * FRAME_WIDTH);
+    else
+        video_cb(nullptr, FRAME_WIDTH, FRAME_HEIGHT, 0);
+    thread_free.push(frame);
 }
 
 
 static void update_variables(void) {
+  struct retro_variable var = { "vectrexia_debug_overlay", nullptr };
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    debug_overlay = strcmp(var.value, "enabled") == 0;
+  }
+
+  var.key = "vectrexia_audio_rate";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    auto rate = (unsigned) strtoul(var.value, nullptr, 10);
+    if (rate && rate != audio_rate) {
+      audio_rate = rate;
+      vectrex->psg_->SetSampleRate(rate);
+    }
+  }
+
+  var.key = "vectrexia_frame_timing";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    refresh_sync = strcmp(var.value, "game refresh") == 0;
+  }
+
+  var.key = "vectrexia_runahead";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    runahead_frames = (unsigned) strtoul(var.value, nullptr, 10);
+  }
+
+  var.key = "vectrexia_rewind";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    if (strcmp(var.value, "enabled") != 0)
+      rewind_buffer.reset();
+    else if (!rewind_buffer)
+      rewind_buffer = std::make_unique<RewindBuffer>(REWIND_BUFFER_SIZE, REWIND_CHECKPOINTS);
+  }
+
+  var.key = "vectrexia_rewind_interval";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    rewind_interval = std::max(1u, (unsigned) strtoul(var.value, nullptr, 10));
+  }
+
+  var.key = "vectrexia_fastforward_skip";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    fastforward_skip = (unsigned) strtoul(var.value, nullptr, 10);
+  }
+
+  var.key = "vectrexia_perf_log";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    set_perf_log(strcmp(var.value, "enabled") == 0);
+  }
+
+  var.key = "vectrexia_threaded";
+  var.value = nullptr;
+
+  if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
+    threaded = strcmp(var.value, "enabled") == 0;
+    if (!threaded)
+      stop_thread();
+  }
+
 #ifdef VECTREXIA_DEBUG
-  struct retro_variable var = {
-      .key = "vectrexia_internal_slowdown",
-  };
+  var.key = "vectrexia_internal_slowdown";
+  var.value = nullptr;
 
   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value) {
     char str[100];
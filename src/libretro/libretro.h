@@ -890,6 +890,66 @@ enum retro_mod
  * Returns the specified language of the frontend, if specified by the user.
  * It can be used by the core for localization purposes.
  */
+#define RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER (40 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+/* struct retro_framebuffer * --
+ * Returns a preallocated framebuffer which the core can use for rendering
+ * the frame into when not using SET_HW_RENDER.
+ * The framebuffer returned from this call must not be used
+ * after the current call to retro_run() returns.
+ *
+ * The goal of this call is to allow zero-copy behavior where a core
+ * can render directly into video memory, avoiding extra bandwidth cost by copying
+ * memory from core to video memory.
+ *
+ * If this call succeeds and the core renders into it,
+ * the framebuffer pointer and pitch can be passed to retro_video_refresh_t.
+ * If the buffer from GET_CURRENT_SOFTWARE_FRAMEBUFFER is to be used,
+ * the core must pass the exact
+ * same pointer as returned by GET_CURRENT_SOFTWARE_FRAMEBUFFER;
+ * i.e. passing a pointer which is offset from the
+ * buffer is undefined. The width, height and pitch parameters
+ * must also match exactly to the values obtained from GET_CURRENT_SOFTWARE_FRAMEBUFFER.
+ *
+ * It is possible for a frontend to return a different pixel format
+ * than the one used in SET_PIXEL_FORMAT. This can happen if the frontend
+ * needs to perform conversion.
+ *
+ * It is still valid for a core to render to a different buffer
+ * even if GET_CURRENT_SOFTWARE_FRAMEBUFFER succeeds.
+ *
+ * A frontend must make sure that the pointer obtained from this function is
+ * writeable (and readable).
+ */
+#define RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE (47 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+/* int * --
+ * Tells the core if the frontend wants audio or video.
+ * If disabled, the frontend will discard the audio or video,
+ * so the core may decide to skip generating a frame or generating audio.
+ * This is mainly used for increasing performance.
+ * Bit 0 (value 1): Enable Video
+ * Bit 1 (value 2): Enable Audio
+ * Bit 2 (value 4): Use Fast Savestates.
+ * Bit 3 (value 8): Hard Disable Audio
+ * Other bits are reserved for future use and will default to zero.
+ * If video is disabled:
+ * * The frontend wants the core to not generate any video,
+ *   including presenting frames via hardware acceleration.
+ * * The frontend's video frame callback will do nothing.
+ * * After running the frame, the video output of the next frame should be
+ *   no different than if video was enabled, and saving and loading state
+ *   should have no issues.
+ * If audio is disabled:
+ * * The frontend wants the core to not generate any audio.
+ * * The frontend's audio callbacks will do nothing.
+ * * After running the frame, the audio output of the next frame should be
+ *   no different than if audio was enabled, and saving and loading state
+ *   should have no issues.
+ */
+#define RETRO_ENVIRONMENT_GET_FASTFORWARDING (49 | RETRO_ENVIRONMENT_EXPERIMENTAL)
+/* bool * --
+ * Boolean value that indicates whether or not the frontend is in
+ * fastforwarding mode.
+ */
 
 #define RETRO_MEMDESC_CONST     (1 << 0)   /* The frontend will never change this memory area once retro_load_game has returned. */
 #define RETRO_MEMDESC_BIGENDIAN (1 << 1)   /* The memory area contains big endian data. Default is little endian. */
@@ -1706,6 +1766,36 @@ enum retro_pixel_format
             RETRO_PIXEL_FORMAT_UNKNOWN  = INT_MAX
 };
 
+#define RETRO_MEMORY_ACCESS_WRITE (1 << 0)
+/* The core will write to the buffer provided by retro_framebuffer::data. */
+#define RETRO_MEMORY_ACCESS_READ (1 << 1)
+/* The core will read from retro_framebuffer::data. */
+#define RETRO_MEMORY_TYPE_CACHED (1 << 0)
+/* The memory in data is cached.
+ * If not cached, random writes and/or reading from the buffer is expected to be very slow. */
+struct retro_framebuffer
+{
+    void *data;                      /* The framebuffer which the core can render into.
+                                        Set by frontend in GET_CURRENT_SOFTWARE_FRAMEBUFFER.
+                                        The initial contents of data are unspecified. */
+    unsigned width;                  /* The framebuffer width used by the core. Set by core. */
+    unsigned height;                 /* The framebuffer height used by the core. Set by core. */
+    size_t pitch;                    /* The number of bytes between the beginning of a scanline,
+                                        and beginning of the next scanline.
+                                        Set by frontend in GET_CURRENT_SOFTWARE_FRAMEBUFFER. */
+    enum retro_pixel_format format;  /* The pixel format the core must use to render into data.
+                                        This format could differ from the format used in
+                                        SET_PIXEL_FORMAT.
+                                        Set by frontend in GET_CURRENT_SOFTWARE_FRAMEBUFFER. */
+
+    unsigned access_flags;           /* How the core will access the memory in the framebuffer.
+                                        RETRO_MEMORY_ACCESS_* flags.
+                                        Set by core. */
+    unsigned memory_flags;           /* Flags telling core how the memory has been mapped.
+                                        RETRO_MEMORY_TYPE_* flags.
+                                        Set by frontend in GET_CURRENT_SOFTWARE_FRAMEBUFFER. */
+};
+
 struct retro_message
 {
     const char *msg;        /* Message to be displayed. */
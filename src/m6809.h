@@ -1440,6 +1440,21 @@ public:
     m6809_error_t Execute(uint64_t &cycles, m6809_interrupt_t irq=NONE);
 
     Registers &getRegisters() { return registers; }
+
+    // The registers are saved one by one, the exchange tables point into the registers of this CPU
+    template<typename S>
+    void Serialize(S &s)
+    {
+        s.value(registers.D);
+        s.value(registers.X);
+        s.value(registers.Y);
+        s.value(registers.PC);
+        s.value(registers.USP);
+        s.value(registers.SP);
+        s.value(registers.DP);
+        s.value(registers.CC);
+        s.value(irq_state);
+    }
 };
 
 #endif //VECTREXIA_M6809_H
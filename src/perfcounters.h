@@ -0,0 +1,97 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_PERFCOUNTERS_H
+#define VECTREXIA_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <array>
+
+/*
+ * Timers for the parts of a frame.
+ *
+ * The ticks come from a clock handed in by the owner, eg. the frontend's performance counter, and the time and the
+ * number of calls of each section are added up until Reset(). The emulation is only timed while it is given a
+ * PerfCounters, without one the untimed code runs.
+ */
+class PerfCounters
+{
+public:
+    enum section_t
+    {
+        CPU,            // executing instructions
+        VIA,            // stepping the VIA and reading the controls, a call per cycle, timed on a sample
+        VECTORIZER,     // stepping the vectorizer, a call per cycle, timed on a sample
+        SEGMENTS,       // joining the vectors into lines, and fading them
+        RASTER,         // drawing the lines, a call per line
+        CONVERT,        // converting the frame to the output pixel format
+        AUDIO,          // rendering and reading the samples
+        SECTIONS
+    };
+    using clock_t = uint64_t (*)();
+
+    explicit PerfCounters(clock_t clock) : clock_(clock) {}
+
+    uint64_t Now() const { return clock_(); }
+
+    void Add(section_t section, uint64_t ticks, uint64_t calls = 1)
+    {
+        total_[section] += ticks;
+        calls_[section] += calls;
+    }
+
+    uint64_t Total(section_t section) const { return total_[section]; }
+    uint64_t Calls(section_t section) const { return calls_[section]; }
+
+    void Reset()
+    {
+        total_.fill(0);
+        calls_.fill(0);
+    }
+
+    static const char *Name(section_t section)
+    {
+        static const char *names[SECTIONS] = {"cpu", "via", "vectorizer", "segments", "raster", "convert", "audio"};
+        return names[section];
+    }
+
+    // Times a section until the end of the scope, if there are counters
+    class Timer
+    {
+        PerfCounters *perf_;
+        section_t section_;
+        uint64_t start_;
+    public:
+        Timer(PerfCounters *perf, section_t section)
+            : perf_(perf), section_(section), start_(perf ? perf->Now() : 0) {}
+        ~Timer()
+        {
+            if (perf_)
+                perf_->Add(section_, perf_->Now() - start_);
+        }
+        Timer(const Timer&) = delete;
+        Timer &operator=(const Timer&) = delete;
+    };
+
+private:
+    clock_t clock_;
+    std::array<uint64_t, SECTIONS> total_{};
+    std::array<uint64_t, SECTIONS> calls_{};
+};
+
+#endif //VECTREXIA_PERFCOUNTERS_H
@@ -0,0 +1,218 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cstring>
+#include <algorithm>
+#include "rewindbuffer.h"
+
+// A word of the state, the last word is padded with zeros
+static inline uint64_t state_word(const uint8_t *state, size_t size, size_t word)
+{
+    uint64_t value = 0;
+    const size_t offset = word * sizeof(uint64_t);
+    if (offset + sizeof(uint64_t) <= size)
+        memcpy(&value, state + offset, sizeof(uint64_t));
+    else if (offset < size)
+        memcpy(&value, state + offset, size - offset);
+    return value;
+}
+
+RewindBuffer::RewindBuffer(size_t capacity, size_t max_checkpoints)
+    : ring_(capacity), checkpoints_(std::max<size_t>(max_checkpoints, 1))
+{
+}
+
+// The delta is a list of runs, each run is the number of words to skip and the number of words that follow, as two
+// uint32_t. A run carries on over a single zero word.
+size_t RewindBuffer::Encode(const uint8_t *state, size_t size)
+{
+    const size_t words = (std::max(size, current_size_) + 7) / sizeof(uint64_t);
+    uint8_t *out = delta_.data();
+    size_t length = 0;
+    size_t word = 0;
+
+    auto diff = [&](size_t w) { return state_word(state, size, w) ^ current_[w]; };
+
+    while (word < words)
+    {
+        const size_t start = word;
+        while (word < words && !diff(word))
+            word++;
+        if (word == words)
+            break;
+
+        const size_t run = length;
+        const auto skip = (uint32_t) (word - start);
+        length += 2 * sizeof(uint32_t);
+
+        const size_t first = word;
+        while (word < words)
+        {
+            const uint64_t value = diff(word);
+            if (!value && (word + 1 == words || !diff(word + 1)))
+                break;
+            memcpy(out + length, &value, sizeof(value));
+            length += sizeof(value);
+            word++;
+        }
+
+        const auto count = (uint32_t) (word - first);
+        memcpy(out + run, &skip, sizeof(skip));
+        memcpy(out + run + sizeof(skip), &count, sizeof(count));
+    }
+    return length;
+}
+
+void RewindBuffer::Decode(const uint8_t *delta, size_t length)
+{
+    size_t pos = 0;
+    size_t word = 0;
+    while (pos < length)
+    {
+        uint32_t skip, count;
+        memcpy(&skip, delta + pos, sizeof(skip));
+        memcpy(&count, delta + pos + sizeof(skip), sizeof(count));
+        pos += 2 * sizeof(uint32_t);
+        word += skip;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint64_t value;
+            memcpy(&value, delta + pos, sizeof(value));
+            current_[word++] ^= value;
+            pos += sizeof(value);
+        }
+    }
+}
+
+// Find room for length bytes in the ring, dropping the oldest checkpoints until there is
+bool RewindBuffer::Reserve(size_t length, size_t &offset)
+{
+    if (length > ring_.size())
+        return false;
+
+    while (count_ > 0)
+    {
+        const size_t tail = checkpoints_[first_].offset;
+        if (tail < head_)
+        {
+            // the deltas are in [tail, head), there may be room after them or before them
+            if (head_ + length <= ring_.size())
+            {
+                offset = head_;
+                return true;
+            }
+            if (length <= tail)
+            {
+                offset = 0;
+                return true;
+            }
+        }
+        else if (head_ + length <= tail)
+        {
+            // the deltas wrap around the end, there may be room between the newest and the oldest
+            offset = head_;
+            return true;
+        }
+        DropOldest();
+    }
+    offset = 0;
+    return true;
+}
+
+void RewindBuffer::DropOldest()
+{
+    used_ -= checkpoints_[first_].length;
+    first_ = (first_ + 1) % checkpoints_.size();
+    if (--count_ == 0)
+        head_ = 0;
+}
+
+bool RewindBuffer::Push(const void *state, size_t size)
+{
+    const auto *bytes = static_cast<const uint8_t*>(state);
+    const size_t words = (size + 7) / sizeof(uint64_t);
+    if (words > current_.size())
+    {
+        current_.resize(words, 0);
+        // a run of one word is the worst case, there are at least two words between runs
+        delta_.resize(current_.size() * sizeof(uint64_t) * 2 + 2 * sizeof(uint32_t));
+    }
+    returned_ = false;
+
+    bool stored = true;
+    if (has_current_)
+    {
+        // the delta takes the new checkpoint back to the current one
+        const size_t length = Encode(bytes, size);
+        if (count_ == checkpoints_.size())
+            DropOldest();
+
+        size_t offset;
+        if (Reserve(length, offset))
+        {
+            memcpy(ring_.data() + offset, delta_.data(), length);
+            checkpoints_[(first_ + count_) % checkpoints_.size()] = {offset, length, current_size_};
+            count_++;
+            head_ = offset + length;
+            used_ += length;
+        }
+        else
+        {
+            first_ = count_ = head_ = used_ = 0;
+            stored = false;
+        }
+    }
+
+    const size_t end = std::max(words, (current_size_ + 7) / sizeof(uint64_t)) * sizeof(uint64_t);
+    auto *current = reinterpret_cast<uint8_t*>(current_.data());
+    memcpy(current, bytes, size);
+    memset(current + size, 0, end - size);
+    current_size_ = size;
+    has_current_ = true;
+    return stored;
+}
+
+const uint8_t *RewindBuffer::Rewind(size_t &size)
+{
+    if (!has_current_)
+        return nullptr;
+
+    if (returned_ && count_ > 0)
+    {
+        const auto &newest = checkpoints_[(first_ + count_ - 1) % checkpoints_.size()];
+        Decode(ring_.data() + newest.offset, newest.length);
+        current_size_ = newest.size;
+        used_ -= newest.length;
+        head_ = newest.offset;
+        if (--count_ == 0)
+            head_ = 0;
+    }
+    returned_ = true;
+
+    size = current_size_;
+    return reinterpret_cast<const uint8_t*>(current_.data());
+}
+
+void RewindBuffer::Clear()
+{
+    first_ = count_ = head_ = used_ = 0;
+    current_size_ = 0;
+    has_current_ = false;
+    returned_ = false;
+    std::fill(current_.begin(), current_.end(), 0);
+}
@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_REWINDBUFFER_H
+#define VECTREXIA_REWINDBUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+ * A ring of savestates to rewind through.
+ *
+ * Only the newest checkpoint is kept whole. Each older one is kept as a delta from the checkpoint after it, the two
+ * are XORed a word at a time and the runs of zero words are left out. Consecutive states mostly differ in a few
+ * bytes of RAM, so a delta is small. The deltas are kept in a ring of a fixed number of bytes, when it is full the
+ * oldest checkpoints are dropped.
+ *
+ * The memory is allocated up front, and again only when a larger state than before is pushed, so in a steady state
+ * Push() and Rewind() do not allocate.
+ */
+class RewindBuffer
+{
+    // a delta in the ring, size is the size of the state it gives back
+    struct checkpoint_t
+    {
+        size_t offset;
+        size_t length;
+        size_t size;
+    };
+
+    std::vector<uint8_t> ring_;
+    std::vector<checkpoint_t> checkpoints_;
+    size_t first_ = 0;
+    size_t count_ = 0;
+    size_t head_ = 0;
+    size_t used_ = 0;
+
+    // the newest checkpoint, zero past its size
+    std::vector<uint64_t> current_;
+    size_t current_size_ = 0;
+    bool has_current_ = false;
+    // the newest checkpoint was returned by Rewind(), it is dropped when Rewind() is called again
+    bool returned_ = false;
+
+    std::vector<uint8_t> delta_;
+
+    size_t Encode(const uint8_t *state, size_t size);
+    void Decode(const uint8_t *delta, size_t length);
+    bool Reserve(size_t length, size_t &offset);
+    void DropOldest();
+
+public:
+    // capacity is the number of bytes for the deltas, at most max_checkpoints are kept
+    RewindBuffer(size_t capacity, size_t max_checkpoints);
+
+    // Add a checkpoint. Returns false if the delta does not fit in the ring at all, the checkpoint is then the only
+    // one left.
+    bool Push(const void *state, size_t size);
+
+    // Go back a checkpoint. The first call returns the newest checkpoint and every call after goes back one more,
+    // until Push() is called. The oldest checkpoint is returned again once the others are used up. Returns nullptr
+    // when there are no checkpoints, the state is valid until the next call.
+    const uint8_t *Rewind(size_t &size);
+
+    void Clear();
+
+    size_t Count() const { return count_ + (has_current_ ? 1 : 0); }
+    size_t Used() const { return used_; }
+};
+
+#endif //VECTREXIA_REWINDBUFFER_H
@@ -0,0 +1,109 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cstring>
+#include <algorithm>
+#include "romimage.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+RomImage::~RomImage()
+{
+    if (mapping_) {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping_);
+#else
+        munmap(mapping_, mapping_size_);
+#endif
+    }
+}
+
+std::shared_ptr<const RomImage> RomImage::Copy(const uint8_t *data, size_t size, size_t padding)
+{
+    std::shared_ptr<RomImage> image(new RomImage());
+    padding = padding ? padding : 1;
+    image->storage_.assign(std::max<size_t>(1, (size + padding - 1) / padding) * padding, 0);
+    if (size)
+        memcpy(image->storage_.data(), data, size);
+    image->data_ = image->storage_.data();
+    image->size_ = size;
+    image->readable_ = image->storage_.size();
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::Wrap(const uint8_t *data, size_t size)
+{
+    std::shared_ptr<RomImage> image(new RomImage());
+    image->data_ = data;
+    image->size_ = size;
+    image->readable_ = size;
+    return image;
+}
+
+std::shared_ptr<const RomImage> RomImage::Map(const char *path)
+{
+    std::shared_ptr<RomImage> image(new RomImage());
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+        return nullptr;
+
+    // the view keeps the mapping open
+    image->mapping_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!image->mapping_)
+        return nullptr;
+    image->mapping_size_ = (size_t) size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        mapping = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    image->mapping_ = mapping;
+    image->mapping_size_ = (size_t) st.st_size;
+#endif
+    image->data_ = static_cast<const uint8_t*>(image->mapping_);
+    image->size_ = image->mapping_size_;
+    image->readable_ = image->mapping_size_;
+    return image;
+}
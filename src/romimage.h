@@ -0,0 +1,63 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_ROMIMAGE_H
+#define VECTREXIA_ROMIMAGE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/*
+ * An immutable ROM image that any number of Vectrex instances can share read-only.
+ *
+ * The data is either copied once into the image, borrowed from memory that outlives it, or memory mapped from a file.
+ * A copy is zero padded to a non-zero multiple of the padding size, readable() is the number of bytes that can be read
+ * and can be more than size().
+ */
+class RomImage
+{
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+    size_t readable_ = 0;
+
+    std::vector<uint8_t> storage_;
+    void *mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+
+    RomImage() = default;
+
+public:
+    RomImage(const RomImage&) = delete;
+    RomImage &operator=(const RomImage&) = delete;
+    ~RomImage();
+
+    // Copy the data into a new image, padded with zeros to a multiple of padding bytes
+    static std::shared_ptr<const RomImage> Copy(const uint8_t *data, size_t size, size_t padding = 1);
+    // Use data without copying it, it must outlive the image
+    static std::shared_ptr<const RomImage> Wrap(const uint8_t *data, size_t size);
+    // Map a file read-only, returns nullptr if the file cannot be mapped
+    static std::shared_ptr<const RomImage> Map(const char *path);
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t readable() const { return readable_; }
+};
+
+#endif //VECTREXIA_ROMIMAGE_H
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_SAVESTATE_H
+#define VECTREXIA_SAVESTATE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Savestates are flat binary snapshots in host byte order.
+ *
+ * Every component has a single Serialize(S &s) template that lists its state, it is called with a StateWriter to save
+ * and with a StateReader to load, so the two can not drift apart. Only plain data is stored, values with
+ * s.value() and vectors of plain data, prefixed with their length, with s.vector(). Settings, such as the sample
+ * rate or the controls, are not part of the state.
+ *
+ * The structures that are saved whole are laid out without padding, so that the same state is always saved as the
+ * same bytes, and states can be compared.
+ */
+static const uint32_t STATE_MAGIC = 0x54535856;   // "VXST"
+static const uint32_t STATE_VERSION = 3;
+// The state includes the vectors on screen, without them the screen starts black when the state is loaded
+static const uint32_t STATE_FLAG_SCREEN = 1;
+
+class StateWriter
+{
+    uint8_t *data_;
+    size_t capacity_;
+    size_t size_ = 0;
+    bool ok_ = true;
+
+public:
+    static constexpr bool saving = true;
+
+    // Without a buffer the writer only counts the bytes the state needs
+    explicit StateWriter(void *data = nullptr, size_t capacity = 0)
+        : data_(static_cast<uint8_t*>(data)), capacity_(capacity)
+    {
+    }
+
+    inline void bytes(const void *src, size_t length)
+    {
+        if (data_ && length && size_ + length <= capacity_)
+            memcpy(data_ + size_, src, length);
+        size_ += length;
+    }
+
+    template<typename T>
+    inline void value(const T &v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain data can be saved");
+        bytes(&v, sizeof(T));
+    }
+
+    template<typename T>
+    inline void vector(const std::vector<T> &v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain data can be saved");
+        value((uint32_t) v.size());
+        bytes(v.data(), v.size() * sizeof(T));
+    }
+
+    // Mark the state as unusable
+    void fail() { ok_ = false; }
+
+    size_t size() const { return size_; }
+    bool ok() const { return ok_ && (!data_ || size_ <= capacity_); }
+};
+
+class StateReader
+{
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+
+public:
+    static constexpr bool saving = false;
+
+    StateReader(const void *data, size_t size)
+        : data_(static_cast<const uint8_t*>(data)), size_(size)
+    {
+    }
+
+    inline void bytes(void *dst, size_t length)
+    {
+        if (!ok_ || length > size_ - pos_) {
+            ok_ = false;
+            return;
+        }
+        if (length)
+            memcpy(dst, data_ + pos_, length);
+        pos_ += length;
+    }
+
+    template<typename T>
+    inline void value(T &v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain data can be loaded");
+        bytes(&v, sizeof(T));
+    }
+
+    template<typename T>
+    inline void vector(std::vector<T> &v)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain data can be loaded");
+        uint32_t length = 0;
+        value(length);
+        if (!ok_ || length > (size_ - pos_) / sizeof(T)) {
+            ok_ = false;
+            return;
+        }
+        v.resize(length);
+        bytes(v.data(), length * sizeof(T));
+    }
+
+    // Mark the state as unusable, eg. a value that was read is out of range
+    void fail() { ok_ = false; }
+
+    size_t size() const { return pos_; }
+    bool ok() const { return ok_; }
+};
+
+#endif //VECTREXIA_SAVESTATE_H
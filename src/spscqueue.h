@@ -0,0 +1,76 @@
+/*
+Copyright (C) 2016 beardypig
+
+This file is part of Vectrexia.
+
+Vectrexia is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+Vectrexia is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VECTREXIA_SPSCQUEUE_H
+#define VECTREXIA_SPSCQUEUE_H
+
+#include <cstddef>
+#include <array>
+#include <atomic>
+
+/*
+ * A fixed size queue between a single producer thread and a single consumer thread, without locks.
+ *
+ * The slots are a ring of N, a power of two, and the two counters only ever go up. Only the producer writes tail_ and
+ * only the consumer writes head_. Each publishes its counter with a release store after it is done with the slot, and
+ * reads the other's with an acquire load, so a value is complete before the consumer can see it and a slot is free
+ * before the producer can reuse it. The counters are on cache lines of their own, so the two threads do not fight
+ * over a line on every push and pop.
+ */
+template<typename T, size_t N>
+class SPSCQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "the size of the queue must be a power of two");
+
+    std::array<T, N> slots_{};
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+
+public:
+    // Producer: returns false if the queue is full
+    bool push(const T &value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == N)
+            return false;
+        slots_[tail & (N - 1)] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: returns false if the queue is empty
+    bool pop(T &value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_.load(std::memory_order_acquire) == head)
+            return false;
+        value = slots_[head & (N - 1)];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only exact when the other thread is not using the queue
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return N; }
+};
+
+#endif //VECTREXIA_SPSCQUEUE_H
@@ -21,105 +21,71 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdint.h>
 #include <vector>
-#include <functional>
 #include <algorithm>
 
-using update_callback_t = std::function<void(uint64_t)>;
-
 class TimerUtil
 {
 public:
+    // a cycle of the 1.5MHz clock lasts 2000/3 ns
     static inline uint64_t cycles_to_nanos(uint64_t cycles)
     {
-        return (uint64_t) (cycles * (1 / 1.5e-3));
+        return (cycles * 2000) / 3;
     }
 
     static inline uint64_t nanos_to_cycles(uint64_t nanos)
     {
-        return (uint64_t) (nanos / (1 / 1.5e-3));
+        return (nanos * 3) / 2000;
     }
 };
 
+// A queue of values that are applied at a later cycle. The values are plain data so that the queue can be saved.
 template<typename T>
 class UpdateTimer
 {
     struct data
     {
         uint64_t cycles;
-        T *ptr;
         T value;
-
-        bool operator== (const uint64_t &count)
-        {
-            if (cycles <= count)
-            {
-                *ptr = value;
-                return true;
-            }
-            return false;
-        }
     };
 
     std::vector<data> items;
 public:
     // enqueue and item to be updated at a later time
-    void enqueue(uint64_t cycles, T* ptr, T value)
+    void enqueue(uint64_t cycles, const T &value)
     {
-        items.push_back({cycles, ptr, value });
+        items.push_back({cycles, value});
     }
-    void tick(uint64_t cycles)
+
+    // apply the items that are due, in the order they were queued
+    template<typename F>
+    void tick(uint64_t cycles, F apply)
     {
-        // https://en.wikipedia.org/wiki/Erase%E2%80%93remove_idiom
-        items.erase(std::remove(items.begin(), items.end(), cycles), items.end());
+        auto keep = items.begin();
+        for (auto item = items.begin(); item != items.end(); ++item)
+        {
+            if (item->cycles <= cycles)
+                apply(item->value);
+            else
+                *keep++ = *item;
+        }
+        items.erase(keep, items.end());
     }
     void clear()
     {
         items.clear();
     }
-};
-
-class CallbackTimer
-{
-    struct data
-    {
-        uint64_t cycles, remaining_nanos;
-        update_callback_t callback;
-
-        bool operator== (const uint64_t &count)
-        {
-            if (cycles <= count)
-            {
-                callback(remaining_nanos);
-                return true;
-            }
-            return false;
-        }
-    };
 
-    std::vector<data> items;
-public:
-    // enqueue and item to be updated at a later time
-    void enqueue(uint64_t current_cycle, uint64_t nanosecond, update_callback_t callback)
+    // the bytes the queued items add to a state
+    size_t StateSize() const
     {
-        // eg. 7800e-9 / (1/1.5e6) == 7800e-3 / (1/1.5) == 7800 / (1/1.5e-3)
-        uint64_t cycles = TimerUtil::nanos_to_cycles(nanosecond);
-        uint64_t remainder = nanosecond - TimerUtil::cycles_to_nanos(cycles);
-        //printf("A delay of %lldns causes a delay of %lld cycles, with an extra delay of %lldns\n",
-        //       nanosecond, cycles, remainder);
-        items.push_back({ current_cycle + cycles, remainder, callback });
-
-        //printf("Callback queue length: %d\n", items.size());
+        return items.size() * sizeof(data);
     }
-    void tick(uint64_t cycles)
-    {
-        // https://en.wikipedia.org/wiki/Erase%E2%80%93remove_idiom
-        items.erase(std::remove(items.begin(), items.end(), cycles), items.end());
-    }
-    void clear()
+
+    template<typename S>
+    void Serialize(S &s)
     {
-        items.clear();
+        s.vector(items);
     }
-
 };
 
 
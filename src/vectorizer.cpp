@@ -21,11 +21,13 @@ void Vectorizer::Step(uint8_t porta, uint8_t portb, uint8_t zero_, uint8_t blank
 
     blank = blank_;
 
-    signal_queue.tick(cycles);
+    signal_queue.tick(cycles, [this](const signal_update_t &update) {
+        UpdateSignals(update.ramp, update.zero, update.integrators, update.remaining_nanos);
+    });
 
     // sample x is always set
-    float sample_v = dac(porta);
-    float ref_0 = 0.0f;
+    int32_t sample_v = dac(porta);
+    int32_t ref_0 = 0;
 
     // DAC sample is between -2.5, +2.5
     sample_x = sample_v;
@@ -41,7 +43,7 @@ void Vectorizer::Step(uint8_t porta, uint8_t portb, uint8_t zero_, uint8_t blank
                 ref_0 = sample_v * 2;
                 break;
             case 2: // Z Axis (brightness) Sample and Hold
-                sample_z = std::max(0.0f, -sample_v * 2); // clamp to [0, 5]
+                sample_z = std::max(0, -sample_v * 2); // clamp to [0, 5]
                 break;
             default:
                 break;
@@ -52,18 +54,17 @@ void Vectorizer::Step(uint8_t porta, uint8_t portb, uint8_t zero_, uint8_t blank
     auto new_integrator_y = sample_y - ref_0;
 
     uint8_t ramp_ = (uint8_t)portb >> 7;
-    // update RAMP and integrators in 7800ns
-    signal_queue.enqueue(cycles,
-                         signal_delay,
-                         [this, ramp_, zero_, new_integrator_x, new_integrator_y](uint64_t n){
-                             UpdateSignals(ramp_, zero_, {new_integrator_x, new_integrator_y}, n);
-                         });
+    // update RAMP and integrators in 7800ns, the part of the delay that is less than a cycle is passed on
+    const uint64_t delay_cycles = TimerUtil::nanos_to_cycles(signal_delay);
+    signal_queue.enqueue(cycles + delay_cycles,
+                         {signal_delay - TimerUtil::cycles_to_nanos(delay_cycles),
+                          {new_integrator_x, new_integrator_y}, ramp_, zero_});
 
 #ifdef VECTORIZER_DEBUG
-    min_x = std::min(axes.x, min_x);
-    max_x = std::max(axes.x, max_x);
-    min_y = std::min(axes.y, min_y);
-    max_y = std::max(axes.y, max_y);
+    min_x = std::min(axes.volts_x(), min_x);
+    max_x = std::max(axes.volts_x(), max_x);
+    min_y = std::min(axes.volts_y(), min_y);
+    max_y = std::max(axes.volts_y(), max_y);
 #endif
 
     cycles++;
@@ -71,26 +72,27 @@ void Vectorizer::Step(uint8_t porta, uint8_t portb, uint8_t zero_, uint8_t blank
 
 void Vectorizer::UpdateSignals(uint8_t ramp_, uint8_t zero_, const integrators_t &integrators_, uint64_t remaining_nanos)
 {
-    float ramp_time_old = 0.0f;
-    float ramp_time_new = 0.0f;
+    int64_t ramp_time_old = 0;
+    int64_t ramp_time_new = 0;
+    int64_t remaining_time = (int64_t) remaining_nanos * TIME_UNITS_PER_NANO;
 
     if (!ramp_ && ramp) // ramp turning on
     {
         // the change is delayed, so the ramp time will only be what time is left from
         // the current cycle ie. the remainder time
-        ramp_time_new = (float)(time_per_clock - (remaining_nanos / 1.0e9));
+        ramp_time_new = TIME_UNITS_PER_CYCLE - remaining_time;
     }
     else if (ramp_ && !ramp) // ramp turning off
     {
         // when turning off, there is still a partial cycles amount of time to run for...
-        ramp_time_old = (float)(remaining_nanos / 1.0e9);
+        ramp_time_old = remaining_time;
     }
     else if (!ramp_ && !ramp) // still active
     {
         // if the integrators have changed, then you need one vector for the first part of the cycles
         // and another for the second part of the cycle
-        ramp_time_old = (float) (remaining_nanos / 1.0e9);
-        ramp_time_new = time_per_clock - ramp_time_old;
+        ramp_time_old = remaining_time;
+        ramp_time_new = TIME_UNITS_PER_CYCLE - ramp_time_old;
     }
 
     if (!zero_)
@@ -101,18 +103,67 @@ void Vectorizer::UpdateSignals(uint8_t ramp_, uint8_t zero_, const integrators_t
     // draw vectors using the OLD integrator value
     axes.integrate(ramp_time_old, integrators);
 
-    vectors_.push_back({axes, blank, ramp, sample_z / 5.0f, cycles});
+    // the Z axis is between 0 and 256 steps (0v - 5v)
+    int32_t intensity = sample_z << 8;
+
+    AddVector(blank, ramp, intensity);
 
     // draw vectors using the NEW integrator values
     axes.integrate(ramp_time_new, integrators_);
 
-    vectors_.push_back({axes, blank, ramp_, sample_z / 5.0f, cycles});
+    AddVector(blank, ramp_, intensity);
 
     zero = zero_;
     ramp = ramp_;
     integrators = integrators_;
 }
 
+// The vectors that can still change what is drawn. Every vector with the beam on is kept, a blanked vector only ends
+// the line before it, the first one that has not faded. So blanked vectors before the first line are dropped, and
+// in a run of blanked vectors one is only kept if it can outlast all the ones before it. A vector added later fades
+// from a later cycle, at most (later - earlier) / decay_cycles more intensity is left of it.
+void Vectorizer::DrawableVectors(std::vector<Vector> &out) const
+{
+    out.clear();
+    const Vector *line_end = nullptr;
+    bool line = false;
+    for (const auto &vect : vectors_)
+    {
+        if (vect.blank)
+        {
+            out.push_back(vect);
+            line = true;
+            line_end = nullptr;
+            continue;
+        }
+        if (!line)
+            continue;
+        if (line_end)
+        {
+            const int64_t head_start = ((int64_t) (vect.end_cycle - line_end->end_cycle) * INTENSITY_ONE +
+                                        decay_cycles - 1) / decay_cycles;
+            if (vect.intensity + head_start <= line_end->intensity)
+                continue;
+        }
+        out.push_back(vect);
+        line_end = &vect;
+    }
+}
+
+void Vectorizer::FadeVectors()
+{
+    for (auto &vect : vectors_)
+    {
+        // fade the vector based on how long ago it was drawn
+        vect.intensity -= (int32_t) (((cycles - vect.end_cycle) * INTENSITY_ONE) / decay_cycles);
+        vect.end_cycle = cycles;
+    }
+
+    // remove all the vectors that have 0 intensity or less
+    vectors_.erase(std::remove_if(vectors_.begin(), vectors_.end(),
+                                  [](const Vector &v) { return v.intensity <= 0; }), vectors_.end());
+}
+
 //<editor-fold desc="Drawing Methods">
 
 VectorBuffer *Vectorizer::getVectorBuffer()
@@ -122,29 +173,28 @@ VectorBuffer *Vectorizer::getVectorBuffer()
         float x0, y0, x1, y1;
         float intensity0, intensity1;
         uint64_t cycles0, cycles1;
-        line_vector_t(axes_t pos, float intensity_, uint64_t cycles_)
+        line_vector_t(axes_t pos, int32_t intensity_, uint64_t cycles_)
         {
-            x0 = x1 = pos.x;
-            y0 = y1 = pos.y;
-            intensity0 = intensity1 = intensity_;
+            x0 = x1 = pos.volts_x();
+            y0 = y1 = pos.volts_y();
+            intensity0 = intensity1 = intensity_ * (1.0f / INTENSITY_ONE);
             cycles0 = cycles1 = cycles_;
         };
         line_vector_t(axes_t pos, uint64_t cycles_)
         {
-            x0 = x1 = pos.x;
-            y0 = y1 = pos.y;
+            x0 = x1 = pos.volts_x();
+            y0 = y1 = pos.volts_y();
             intensity0 = intensity1 = 0.0f;
             cycles0 = cycles1 = cycles_;
         }
         void set_end(axes_t pos)
         {
-            x1 = pos.x;
-            y1 = pos.y;
+            x1 = pos.volts_x();
+            y1 = pos.volts_y();
         }
     };
 
-    // start with black
-    vector_buffer.clear();
+    const uint64_t start = perf ? perf->Now() : 0;
 
     std::vector<line_vector_t> to_draw;
     std::vector<line_vector_t> debug_to_draw;
@@ -187,15 +237,16 @@ VectorBuffer *Vectorizer::getVectorBuffer()
             }
 #endif
         }
-
-        // fade the vector based on how long ago it was drawn
-        vect->intensity -= ((cycles - vect->end_cycle) * (1.0f / decay_cycles));
-        vect->end_cycle = cycles;
     }
 
-    // remove all the vectors that have 0 intensity or less
-    vectors_.erase(std::remove_if(vectors_.begin(), vectors_.end(),
-                                  [](const Vector &v) { return v.intensity <= 0.0f; }), vectors_.end());
+    FadeVectors();
+
+    const uint64_t joined = perf ? perf->Now() : 0;
+    if (perf)
+        perf->Add(PerfCounters::SEGMENTS, joined - start);
+
+    // start with black, only what was drawn last frame needs to be cleared
+    vector_buffer.clear();
 
     for (const auto &vect: to_draw)
     {
@@ -204,10 +255,13 @@ VectorBuffer *Vectorizer::getVectorBuffer()
             vxgfx::draw_line<vxgfx::m_direct>(vector_buffer, vp,
                 vect.x0 * scale_factor, vect.y0 * scale_factor,
                 vect.x1 * scale_factor, vect.y1 * scale_factor,
-                vxgfx::pf_mono_t{ vect.intensity0 });
+                VectorPixel{ vect.intensity0 });
         }
     }
 
+    if (perf)
+        perf->Add(PerfCounters::RASTER, perf->Now() - joined, to_draw.size());
+
 #ifdef VECTORIZER_DEBUG
     for (const auto &debug_vect: debug_to_draw)
     {
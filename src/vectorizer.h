@@ -8,54 +8,84 @@
 #include <string>
 #include "gfxutil.h"
 #include "updatetimer.h"
+#include "perfcounters.h"
 
 
 static const float VECTOR_MAX_V =  5.0f;
 static const float VECTOR_MIN_V = -5.0f;
-static const float time_per_clock = (float) (1.0f / 1.5e6);
 static const float DEBUG_LINE_INTENSITY = 0.03f;
 static const int FRAME_WIDTH  = 330;
 static const int FRAME_HEIGHT = 410;
 
+// The analog side of the vectorizer is modelled in fixed point so that it gives the same results on every host.
+// Voltages are counted in DAC steps (5v / 256) and time is counted in thirds of a nanosecond, that way one cycle
+// of the 1.5MHz clock is exactly 2000 time units.
+static const int64_t TIME_UNITS_PER_NANO = 3;
+static const int64_t TIME_UNITS_PER_CYCLE = 2000;
+// The integrators move the beam by 10000 * t * v, with v in DAC steps and t in time units, a volt of deflection
+// is (256 / 5) * 3e9 / 10000 position units.
+static const float POSITION_UNITS_PER_VOLT = 15360000.0f;
+// Beam intensity in 16.16 fixed point, 1.0 is full brightness
+static const int32_t INTENSITY_ONE = 1 << 16;
+
 struct integrators_t
 {
-    float x = 0.0f,
-            y = 0.0f;
+    int32_t x = 0,
+            y = 0;
 };
 
 struct axes_t
 {
-    float x = 0.0f,
-            y = 0.0f;
+    int64_t x = 0,
+            y = 0;
     inline void zero() {
-        x = 0.0f;
-        y = 0.0f;
+        x = 0;
+        y = 0;
+    }
+    inline void integrate(int64_t ramp_time, const integrators_t &integrators)
+    {
+        x += ramp_time * integrators.x;
+        y += ramp_time * integrators.y;
+    }
+    inline float volts_x() const
+    {
+        return x * (1.0f / POSITION_UNITS_PER_VOLT);
     }
-    inline void integrate(float ramp_time, const integrators_t &integrators)
+    inline float volts_y() const
     {
-        x += 10000 * ramp_time * integrators.x;
-        y += 10000 * ramp_time * integrators.y;
+        return y * (1.0f / POSITION_UNITS_PER_VOLT);
     }
 };
 
-using VectorBuffer = vxgfx::framebuffer<FRAME_WIDTH, FRAME_HEIGHT, vxgfx::pf_mono_t>;
-using DebugBuffer = vxgfx::framebuffer<FRAME_WIDTH, FRAME_HEIGHT, vxgfx::pf_argb_t>;
+// The pixel format of the vector buffer is selected at build time (see VECTOR_BUFFER_FORMAT), the integer formats
+// need a half or a quarter of the memory of the float format.
+#if defined(VECTREXIA_VECTOR_MONO8)
+using VectorPixel = vxgfx::pf_mono8_t;
+#elif defined(VECTREXIA_VECTOR_MONO16)
+using VectorPixel = vxgfx::pf_mono16_t;
+#else
+using VectorPixel = vxgfx::pf_mono_t;
+#endif
+
+using VectorBuffer = vxgfx::tracked_framebuffer<FRAME_WIDTH, FRAME_HEIGHT, VectorPixel>;
+using DebugBuffer = vxgfx::tracked_framebuffer<FRAME_WIDTH, FRAME_HEIGHT, vxgfx::pf_argb_t>;
 
 class Vectorizer
 {
+    // the vectors and the signal updates are saved, they have no padding
     struct Vector
     {
         axes_t pos;
-        uint8_t blank, ramp;
-        float intensity;
+        int32_t intensity;
+        uint16_t blank, ramp;
         uint64_t end_cycle;
     };
 
-    // Sample and hold voltages (-5v - 5v) for Y axis and Z axis
-    float sample_y = 0.0f;
-    float sample_z = 0.0f;
+    // Sample and hold voltages (-5v - 5v) for Y axis and Z axis, in DAC steps
+    int32_t sample_y = 0;
+    int32_t sample_z = 0;
     // not really a sample and hold, the value of X is whatever is out of the DAC ie. PORTA
-    float sample_x = 0.0f;
+    int32_t sample_x = 0;
 
     // DAC voltage for the X/Y axes
     axes_t axes;
@@ -64,10 +94,10 @@ class Vectorizer
     integrators_t integrators;
 
     // The DAC is connected to PORTA, the MSB of the input is inverted
-    // the output from the DAC will range from -2.5v to +2.5v
-    inline float dac(uint8_t value)
+    // the output from the DAC will range from -2.5v to +2.5v (-127 to +128 steps)
+    inline int32_t dac(uint8_t value)
     {
-        return 2.5f - ((value ^ 0x80) * (5.0f / 256.0f));
+        return 128 - (value ^ 0x80);
     }
 
     template <typename T>
@@ -88,26 +118,63 @@ class Vectorizer
     uint8_t ramp = 1;
 
     // The DAC could add a delay of up to ~150ns.
-    // Total delay:
-    CallbackTimer signal_queue;
+    // Total delay: signal_delay, after which RAMP, ZERO and the integrator inputs are updated
+    struct signal_update_t
+    {
+        uint64_t remaining_nanos;
+        integrators_t integrators;
+        uint32_t ramp, zero;
+    };
+    UpdateTimer<signal_update_t> signal_queue;
 
     uint64_t cycles = 0;
 
     vxgfx::viewport vp;
 
     std::vector<Vector> vectors_;
+    // the vectors that are saved, see DrawableVectors()
+    std::vector<Vector> saved_vectors_;
     VectorBuffer vector_buffer{};
-    DebugBuffer debug_buffer{};
+    DebugBuffer debug_buffer{vxgfx::pf_argb_t(0)};  // transparent
 
     float min_x, max_x, min_y, max_y;
 
+    // A blanked vector only ends the line before it. When the beam is blanked and still, the vectors only differ in
+    // when they were added, so the last one replaces the ones before it, it is the last to fade.
+    inline void AddVector(uint8_t blank_, uint8_t ramp_, int32_t intensity)
+    {
+        if (!blank_ && !vectors_.empty())
+        {
+            auto &last = vectors_.back();
+            if (!last.blank && last.pos.x == axes.x && last.pos.y == axes.y && intensity >= last.intensity)
+            {
+                last = {axes, intensity, blank_, ramp_, cycles};
+                return;
+            }
+        }
+        vectors_.push_back({axes, intensity, blank_, ramp_, cycles});
+    }
+
+    void DrawableVectors(std::vector<Vector> &out) const;
+
 public:
+    // At most this many vectors are saved with the screen, the oldest are dropped. The BIOS keeps up to 25k on screen.
+    static constexpr size_t MAX_SAVED_VECTORS = 32768;
+    static constexpr size_t MAX_SCREEN_STATE = sizeof(uint32_t) + MAX_SAVED_VECTORS * sizeof(Vector);
+    // the bytes the signals on their way add to a state
+    size_t PendingStateSize() const { return signal_queue.StateSize(); }
+
     void Step(uint8_t porta, uint8_t portb, uint8_t zero, uint8_t blank);
 
-    // Returns a vxgfx::framebuffer<vxgfx::pf_mono_t>
+    // Returns a vxgfx::tracked_framebuffer<VectorPixel>, only the row spans drawn this frame or the
+    // last frame differ from the previous frame, see VectorBuffer::dirty()
     VectorBuffer *getVectorBuffer();
 
-    // Returns a vxgfx::framebuffer<vxgfx::pf_argb_t>
+    // Fade the vectors to the end of a frame that is not drawn, getVectorBuffer() fades them after drawing
+    void FadeVectors();
+
+    // Returns a transparent vxgfx::tracked_framebuffer<vxgfx::pf_argb_t> overlay, the owner of the output
+    // composites it with vxgfx::composite() and clears it once the frame is presented
     DebugBuffer *getDebugBuffer();
 
     uint64_t signal_delay = 7800;
@@ -115,8 +182,40 @@ public:
     float scale_factor = 1.0f;
     float pan_offset_x = 0.0f;
     float pan_offset_y = 0.0f;
+    PerfCounters *perf = nullptr;   // times drawing the frame when set
 
     void UpdateSignals(uint8_t ramp, uint8_t zero, const integrators_t &integrators, uint64_t remaining_nanos);
+
+    // The vectors still on screen are saved, but not the framebuffers, the next frame is drawn from the vectors.
+    // Without the screen the vectors are cleared on load.
+    template<typename S>
+    void Serialize(S &s, bool screen = true)
+    {
+        s.value(sample_y);
+        s.value(sample_z);
+        s.value(sample_x);
+        s.value(axes);
+        s.value(integrators);
+        s.value(blank);
+        s.value(zero);
+        s.value(ramp);
+        s.value(cycles);
+        signal_queue.Serialize(s);
+        if (!screen) {
+            if (!S::saving)
+                vectors_.clear();
+        }
+        else if (S::saving) {
+            DrawableVectors(saved_vectors_);
+            if (saved_vectors_.size() > MAX_SAVED_VECTORS)
+                saved_vectors_.erase(saved_vectors_.begin(),
+                                     saved_vectors_.end() - MAX_SAVED_VECTORS);
+            s.vector(saved_vectors_);
+        }
+        else {
+            s.vector(vectors_);
+        }
+    }
 };
 
 
@@ -17,11 +17,14 @@ You should have received a copy of the GNU General Public License
 along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <string>
+#include <cstring>
 #include <bitset>
 #include <memory>
 #include <array>
+#include <algorithm>
 #include "vectrexia.h"
 #include "cartridge.h"
+#include "savestate.h"
 
 const char *Vectrex::GetName()
 {
@@ -38,15 +41,40 @@ void Vectrex::Reset()
     cpu_->Reset();
 }
 
-uint64_t Vectrex::Run(uint64_t cycles)
+uint64_t Vectrex::Run(uint64_t cycles, bool to_refresh)
+{
+    // the timed loop is a copy of its own, so that the untimed one has no checks in it
+    return perf_ ? RunCycles<true>(cycles, to_refresh) : RunCycles<false>(cycles, to_refresh);
+}
+
+template<bool Timed>
+uint64_t Vectrex::RunCycles(uint64_t cycles, bool to_refresh)
 {
     uint64_t cycles_run = 0;
+    uint32_t refreshes = via_->getTimer2Starts();
+    uint64_t cpu_ticks = 0, via_ticks = 0, vectorizer_ticks = 0, block_ticks = 0, instructions = 0;
+    // A cycle of the VIA and the vectorizer takes about as long as reading the clock, so the cycles of an instruction
+    // are timed as one lap. The first instruction in every SAMPLE_INTERVAL is timed a part at a time instead, and the
+    // time of the other blocks is split between the VIA and the vectorizer in the same proportion.
+    constexpr uint64_t SAMPLE_INTERVAL = 16;
+    uint64_t now = Timed ? perf_->Now() : 0;
+    // add the time since the last lap to ticks
+    auto lap = [&](uint64_t &ticks) {
+        const uint64_t then = now;
+        now = perf_->Now();
+        ticks += now - then;
+    };
     while (cycles_run < cycles)
     {
         uint64_t cpu_cycles = 0;
         // run one instruction on the CPU
         // The VIA 6522 interrupt line is connected to the M6809 IRQ line
         m6809_error_t rcode = cpu_->Execute(cpu_cycles, (via_->GetIRQ()) ? IRQ : NONE);
+        if (Timed)
+        {
+            lap(cpu_ticks);
+            instructions++;
+        }
         if (rcode != E_SUCCESS)
         {
             auto registers = cpu_->getRegisters();
@@ -61,26 +89,84 @@ uint64_t Vectrex::Run(uint64_t cycles)
         }
 
         // run the VIA for the same number of cycles
+        const bool sampled = Timed && instructions % SAMPLE_INTERVAL == 1;
         for (int via_cycles = 0; via_cycles < cpu_cycles; via_cycles++)
         {
             via_->Step();
+            if (sampled)
+                lap(via_ticks);
             vector_buffer_.Step(via_->getPortAState(), via_->getPortBState(),
                                 via_->getCA2State(), via_->getCB2State());
+            if (sampled)
+                lap(vectorizer_ticks);
             UpdateJoystick(via_->getPortAState(), via_->getPortBState());
-            psg_->Step(via_->getPortAState(), (uint8_t) ((via_->getPortBState() >> 3) & 1),
-                       1, (uint8_t) ((via_->getPortBState() >> 4) & 1));
+            if (sampled)
+                lap(via_ticks);
             this->cycles++;
         }
+        if (Timed && !sampled)
+            lap(block_ticks);
 
         cycles_run += cpu_cycles;
+
+        // the game has started a new refresh
+        if (via_->getTimer2Starts() != refreshes)
+        {
+            refreshes = via_->getTimer2Starts();
+            refresh_period_ = last_refresh_ ? this->cycles - last_refresh_ : 0;
+            last_refresh_ = this->cycles;
+            if (to_refresh)
+                break;
+        }
+    }
+
+    if (Timed)
+    {
+        const uint64_t sampled_ticks = via_ticks + vectorizer_ticks;
+        const auto via_share = sampled_ticks ? (uint64_t) ((double) block_ticks * via_ticks / sampled_ticks)
+                                             : block_ticks / 2;
+        via_ticks += via_share;
+        vectorizer_ticks += block_ticks - via_share;
+        perf_->Add(PerfCounters::CPU, cpu_ticks, instructions);
+        perf_->Add(PerfCounters::VIA, via_ticks, cycles_run);
+        perf_->Add(PerfCounters::VECTORIZER, vectorizer_ticks, cycles_run);
     }
     return cycles_run;
 }
 
+void Vectrex::SetPerfCounters(PerfCounters *perf)
+{
+    perf_ = perf;
+    vector_buffer_.perf = perf;
+}
+
+uint64_t Vectrex::RunFrame(uint64_t cycles, bool to_refresh)
+{
+    const uint64_t target = cycles - std::min(frame_overrun_, cycles - 1);
+    const uint64_t last_refresh = last_refresh_;
+    const uint64_t cycles_run = Run(target, to_refresh);
+
+    // a frame that ended on a refresh did not run over
+    if (to_refresh && last_refresh_ != last_refresh)
+        frame_overrun_ = 0;
+    else
+        frame_overrun_ = (cycles_run > target) ? cycles_run - target : 0;
+    return cycles_run;
+}
+
 bool Vectrex::LoadCartridge(const uint8_t *data, size_t size)
 {
     cartridge_ = std::make_unique<Cartridge>();
     cartridge_->Load(data, size);
+    cartridge_->SetPB6((uint8_t) (via_->getPortBState() >> 6));
+    return cartridge_->is_loaded();
+}
+
+bool Vectrex::LoadCartridge(std::shared_ptr<const RomImage> image)
+{
+    cartridge_ = std::make_unique<Cartridge>();
+    cartridge_->Load(std::move(image));
+    cartridge_->SetPB6((uint8_t) (via_->getPortBState() >> 6));
     return cartridge_->is_loaded();
 }
 
@@ -91,6 +177,102 @@ void Vectrex::UnloadCartridge()
         cartridge_->Unload();
 }
 
+// The machine state, the cartridge image and the controls are not included
+template<typename S>
+void Vectrex::Serialize(S &s, bool screen)
+{
+    uint8_t has_cartridge = (uint8_t) (cartridge_ && cartridge_->is_loaded());
+    s.value(has_cartridge);
+    if (has_cartridge != (uint8_t) (cartridge_ && cartridge_->is_loaded())) {
+        s.fail();
+        return;
+    }
+
+    s.value(ram_);
+    s.value(joystick_compare);
+    s.value(psg_port);
+    s.value(cycles);
+    s.value(frame_overrun_);
+    s.value(last_refresh_);
+    s.value(refresh_period_);
+    cpu_->Serialize(s);
+    via_->Serialize(s);
+    psg_->Serialize(s);
+    vector_buffer_.Serialize(s, screen);
+    if (has_cartridge)
+        cartridge_->Serialize(s);
+}
+
+size_t Vectrex::SaveState(void *data, size_t size, bool screen)
+{
+    // the header ends with the size of the state, including the header
+    StateWriter writer(data, size);
+    writer.value(STATE_MAGIC);
+    writer.value(STATE_VERSION);
+    writer.value(screen ? STATE_FLAG_SCREEN : 0u);
+    uint32_t length = 0;
+    writer.value(length);
+    Serialize(writer, screen);
+    if (!writer.ok())
+        return 0;
+
+    if (data)
+    {
+        length = (uint32_t) writer.size();
+        memcpy(static_cast<uint8_t*>(data) + 3 * sizeof(uint32_t), &length, sizeof(length));
+    }
+    return writer.size();
+}
+
+// The state without the screen only varies with the pending PSG writes and samples and with the signals in the delay
+// lines, they are swapped for the most they can be. The delay lines hold a few hundred bytes at most. The screen is
+// at most MAX_SAVED_VECTORS.
+size_t Vectrex::MaxStateSize()
+{
+    const size_t pending = psg_->PendingStateSize() + via_->PendingStateSize() + vector_buffer_.PendingStateSize();
+    return SaveState(nullptr, 0, false) - pending + AY38910::MAX_PENDING_STATE + MAX_DELAYED_STATE +
+           Vectorizer::MAX_SCREEN_STATE;
+}
+
+// Read the header of a state, false if it is not a state that can be loaded
+static bool read_state_header(StateReader &reader, size_t size, uint32_t &flags, uint32_t &length)
+{
+    uint32_t magic = 0, version = 0;
+    reader.value(magic);
+    reader.value(version);
+    reader.value(flags);
+    reader.value(length);
+    return reader.ok() && magic == STATE_MAGIC && version == STATE_VERSION && length <= size;
+}
+
+bool Vectrex::LoadState(const void *data, size_t size)
+{
+    StateReader reader(data, size);
+    uint32_t flags = 0, length = 0;
+    if (!read_state_header(reader, size, flags, length))
+        return false;
+
+    // the state is read straight into the machine, so the machine is kept as it is in case the state turns out to be
+    // damaged part way through, without the screen to keep it cheap
+    size_t kept = rollback_.empty() ? 0 : SaveState(rollback_.data(), rollback_.size(), false);
+    if (!kept)
+    {
+        rollback_.resize(SaveState(nullptr, 0, false));
+        kept = SaveState(rollback_.data(), rollback_.size(), false);
+    }
+
+    Serialize(reader, (flags & STATE_FLAG_SCREEN) != 0);
+    if (reader.ok() && reader.size() == length)
+        return true;
+
+    message("savestate is damaged, keeping the current state");
+    StateReader restore(rollback_.data(), kept);
+    if (read_state_header(restore, kept, flags, length))
+        Serialize(restore, false);
+    if (!restore.ok())
+        Reset();
+    return false;
+}
 
 static uint8_t read_mem(intptr_t ref, uint16_t addr)
 {
@@ -112,6 +294,11 @@ static void store_psg_reg(intptr_t ref, uint8_t data)
     reinterpret_cast<Vectrex*>(ref)->StorePSGReg(data);
 }
 
+static void write_via_ports(intptr_t ref, uint8_t porta, uint8_t portb)
+{
+    reinterpret_cast<Vectrex*>(ref)->WritePorts(porta, portb);
+}
+
 static uint8_t read_via_porta(intptr_t ref)
 {
     return reinterpret_cast<Vectrex*>(ref)->ReadPortA();
@@ -135,6 +322,7 @@ Vectrex::Vectrex() noexcept
     // VIA Callback
     via_->SetPortAReadCallback(read_via_porta, reinterpret_cast<intptr_t>(this));
     via_->SetPortBReadCallback(read_via_portb, reinterpret_cast<intptr_t>(this));
+    via_->SetPortWriteCallback(write_via_ports, reinterpret_cast<intptr_t>(this));
 
     // PSG callbacks
     psg_->SetIOReadCallback(read_psg_io, reinterpret_cast<intptr_t>(this));
@@ -145,7 +333,7 @@ uint8_t Vectrex::Read(uint16_t addr)
 {
     // 0000-7FFF: cartridge
     if (addr < 0x8000 && cartridge_) {
-        return cartridge_->Read(addr, (uint8_t) (via_->getPortBState() >> 6 & 1));
+        return cartridge_->Read(addr);
     }
     // E000-FFFF: system ROM
     else if (addr >= 0xe000) {
@@ -173,7 +361,7 @@ void Vectrex::Write(uint16_t addr, uint8_t data)
 {
     // 0000-7FFF: cartridge
     if (addr < 0x8000 && cartridge_) {
-        cartridge_->Write(addr, (uint8_t) (via_->getPortBState() >> 6 & 1));
+        cartridge_->Write(addr, data);
     }
     // E000-FFFF: system ROM
     else if (addr >= 0xe000) {
@@ -215,6 +403,19 @@ uint8_t Vectrex::ReadPortB() {
     return joystick_compare;
 }
 
+void Vectrex::WritePorts(uint8_t porta, uint8_t portb)
+{
+    // The PSG bus and the cartridge bank only change when a port is written.
+    // PA0-7 - PSG data bus
+    // PB3   - PSG BC1
+    // PB4   - PSG BDIR
+    // PB6   - cartridge bank
+    // BC2 is tied high
+    psg_->Step(cycles, porta, (uint8_t) ((portb >> 3) & 1), 1, (uint8_t) ((portb >> 4) & 1));
+    if (cartridge_)
+        cartridge_->SetPB6((uint8_t) (portb >> 6));
+}
+
 void Vectrex::UpdateJoystick(uint8_t porta, uint8_t portb) {
     // porta is connected to the databus of the sound chip and DAC
     // portb 3+4 and ca1 for sound chip stuff
@@ -297,6 +498,11 @@ VectorBuffer *Vectrex::getFramebuffer()
     return vector_buffer_.getVectorBuffer();
 }
 
+void Vectrex::SkipFramebuffer()
+{
+    vector_buffer_.FadeVectors();
+}
+
 DebugBuffer *Vectrex::getDebugbuffer()
 {
     return vector_buffer_.getDebugBuffer();
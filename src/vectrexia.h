@@ -36,6 +36,7 @@ along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 #include "via6522.h"
 #include "ay38910.h"
 #include "vectorizer.h"
+#include "perfcounters.h"
 
 class Vectrex
 {
@@ -43,9 +44,9 @@ class Vectrex
     const char *kVersion_ = "0.2.0";
 
     // memory areas
-    // 8K of system ROM
+    // 8K of system ROM, shared by every instance
     // 1K of system RAM
-    const std::array<uint8_t, 8192> sysrom_ = system_bios;
+    const uint8_t *sysrom_ = system_bios.data();
     std::array<uint8_t, 1024> ram_{};
 
     // This structure represents the values of the potentiometers and the buttons a vectrex controller
@@ -57,13 +58,31 @@ class Vectrex
     uint8_t joystick_compare;
     uint8_t psg_port;
 
+    // the most the signals in the delay lines add to a state, see MaxStateSize()
+    static constexpr size_t MAX_DELAYED_STATE = 4096;
+
+    // frame timing, see RunFrame()
+    uint64_t frame_overrun_ = 0;
+    uint64_t last_refresh_ = 0;
+    uint64_t refresh_period_ = 0;
+
+    PerfCounters *perf_ = nullptr;
+
+    // the machine before the last LoadState(), see LoadState()
+    std::vector<uint8_t> rollback_;
+
+    template<typename S>
+    void Serialize(S &s, bool screen);
+    template<bool Timed>
+    uint64_t RunCycles(uint64_t cycles, bool to_refresh);
+
 public:
     std::unique_ptr<Cartridge> cartridge_{};
     std::unique_ptr<M6809> cpu_{};
     std::unique_ptr<VIA6522> via_{};
     std::unique_ptr<AY38910> psg_{};
     Vectorizer vector_buffer_;
-    uint64_t cycles;
+    uint64_t cycles = 0;
 
     Vectrex() noexcept;
     Vectrex(const Vectrex&) = delete;
@@ -73,11 +92,30 @@ public:
     ~Vectrex() = default;
 
     void Reset();
-    uint64_t Run(uint64_t cycles);
+    // Run for at least cycles, with to_refresh the run ends early once the game starts its next refresh
+    uint64_t Run(uint64_t cycles, bool to_refresh = false);
+    // Run a frame of cycles. The cycles the last instruction runs past the end are taken off the next frame, so that
+    // frames average cycles. With to_refresh the frame ends when the game starts its next refresh, like the BIOS
+    // Wait_Recal does by starting VIA timer 2, or after cycles if it does not.
+    uint64_t RunFrame(uint64_t cycles, bool to_refresh = false);
+    // The cycles between the last two refreshes the game started, 0 until there have been two
+    uint64_t RefreshPeriod() const { return refresh_period_; }
+    // Time the emulation and the drawing with perf, or stop timing them with nullptr
+    void SetPerfCounters(PerfCounters *perf);
 
     bool LoadCartridge(const uint8_t *data, size_t size);
+    bool LoadCartridge(std::shared_ptr<const RomImage> image);
     void UnloadCartridge();
 
+    // Write a savestate to data and return its size, or 0 if it needs more than size bytes. Without data only the
+    // size is returned, it changes with the number of vectors on screen. A state without the screen is a few KB.
+    size_t SaveState(void *data, size_t size, bool screen = true);
+    // The largest state SaveState() can write while the cartridge stays the same
+    size_t MaxStateSize();
+    // Load a savestate written by SaveState(). A state that is damaged past its header leaves the machine as it was,
+    // only the screen is cleared.
+    bool LoadState(const void *data, size_t size);
+
     const char *GetName();
     const char *GetVersion();
 
@@ -87,16 +125,24 @@ public:
     void message(const char *fmt, ...);
 
     VectorBuffer *getFramebuffer();
+    // End a frame without drawing it, the screen fades just as if it had been drawn
+    void SkipFramebuffer();
     DebugBuffer *getDebugbuffer();
 
     uint8_t ReadPortA();
     uint8_t ReadPortB();
+    void WritePorts(uint8_t porta, uint8_t portb);
     void UpdateJoystick(uint8_t porta, uint8_t portb);
     void SetPlayerOne(uint8_t x, uint8_t y, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4);
     void SetPlayerTwo(uint8_t x, uint8_t y, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4);
     uint8_t ReadPSGIO();
     void StorePSGReg(uint8_t reg);
     M6809 &GetM6809();
+
+    // The 1K of RAM, mirrored at C800-CFFF, and the 8K system ROM at E000-FFFF
+    uint8_t *GetRAM() { return ram_.data(); }
+    size_t GetRAMSize() const { return ram_.size(); }
+    const uint8_t *GetSystemROM() const { return sysrom_; }
 };
 
 #endif //VECTREXIA_VECTREXIA_H
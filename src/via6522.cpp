@@ -131,6 +131,8 @@ void VIA6522::Write(uint8_t reg, uint8_t data)
             }
 
             registers.ORB = data;
+            if (port_write_callback_func)
+                port_write_callback_func(port_write_callback_ref, getPortAState(), getPortBState());
             break;
         case REG_ORA:
             // If CA2 is output
@@ -139,6 +141,8 @@ void VIA6522::Write(uint8_t reg, uint8_t data)
             }
         case REG_ORA_NO_HANDSHAKE:
             registers.ORA = data;
+            if (port_write_callback_func)
+                port_write_callback_func(port_write_callback_ref, getPortAState(), getPortBState());
             break;
 
             // Timer 1
@@ -173,11 +177,12 @@ void VIA6522::Write(uint8_t reg, uint8_t data)
             break;
         case REG_T2CH:  // timer 2 high-order counter
             registers.T2CH = data;
-            timer2.counter = (registers.T2CH << 8) | registers.T1CL;
+            timer2.counter = (registers.T2CH << 8) | registers.T2CL;
 
             // start timer 2
             timer2.enabled = true;
             timer2.one_shot = false;
+            timer2_starts++;
 
             // clear the timer 2 interrupt
             set_ifr(TIMER2_INT, 0);
@@ -277,7 +282,12 @@ void VIA6522::Reset()
 void VIA6522::Step()
 {
     // Update any delayed signals
-    delayed_signals.tick(clk++);
+    delayed_signals.tick(clk++, [this](const delayed_signal_t &signal) {
+        if (signal.line == SIGNAL_CA2)
+            ca2_state = signal.value;
+        else
+            cb2_state = signal.value;
+    });
 
     // Timers
     if (timer1.enabled) {
@@ -358,11 +368,11 @@ void VIA6522::Step()
     // End of pulse mode handshake
     // If PORTA is using pulse mode handshaking, restore CA2 to 1 at the beginning of the next cycle
     if ((registers.PCR & CA2_MASK) == CA2_OUT_PULSE)
-        delayed_signals.enqueue(clk+1, &ca2_state, 1);
+        delayed_signals.enqueue(clk+1, {SIGNAL_CA2, 1});
 
     // Same for PORTB
     if ((registers.PCR & CB2_MASK) == CB2_OUT_PULSE)
-        delayed_signals.enqueue(clk+1, &ca2_state, 1);
+        delayed_signals.enqueue(clk+1, {SIGNAL_CB2, 1});
 
 
 }
@@ -379,6 +389,12 @@ void VIA6522::SetPortBReadCallback(VIA6522::port_callback_t func, intptr_t ref)
     portb_callback_ref = ref;
 }
 
+void VIA6522::SetPortWriteCallback(VIA6522::port_write_callback_t func, intptr_t ref)
+{
+    port_write_callback_func = func;
+    port_write_callback_ref = ref;
+}
+
 uint8_t VIA6522::GetIRQ()
 {
     return registers.IFR & IRQ_MASK;
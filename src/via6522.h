@@ -134,6 +134,15 @@ class VIA6522
 {
     using port_callback_t = uint8_t (*)(intptr_t);
     using update_callback_t = void (*)(intptr_t, uint8_t, uint8_t, bool, bool, bool, bool);
+    using port_write_callback_t = void (*)(intptr_t, uint8_t, uint8_t);
+
+    // a signal line that is set to a value at a later cycle (no padding, it is saved)
+    enum { SIGNAL_CA2, SIGNAL_CB2 };
+    struct delayed_signal_t
+    {
+        uint32_t line;
+        uint32_t value;
+    };
 
     struct Timer
     {
@@ -232,14 +241,21 @@ class VIA6522
 
     uint64_t clk;
 
+    // the number of times timer 2 has been started, not saved
+    uint32_t timer2_starts = 0;
+
     // port a/b read callbacks
     port_callback_t porta_callback_func = nullptr;
     intptr_t        porta_callback_ref = 0;
     port_callback_t portb_callback_func = nullptr;
     intptr_t        portb_callback_ref = 0;
 
+    // port a/b write callback, called with the new port a and port b states
+    port_write_callback_t port_write_callback_func = nullptr;
+    intptr_t              port_write_callback_ref = 0;
+
     // Signals that need to be updated in the future
-    UpdateTimer<uint8_t> delayed_signals;
+    UpdateTimer<delayed_signal_t> delayed_signals;
 
     // Update the state of the IFR
     inline void update_ifr(void) {
@@ -323,6 +339,8 @@ public:
     void SetPortAReadCallback(port_callback_t func, intptr_t ref);
     void SetPortBReadCallback(port_callback_t func, intptr_t ref);
     void SetUpdateCallback(update_callback_t func, intptr_t ref);
+    // Called when ORA or ORB is written, so devices on the ports do not need to poll them every cycle
+    void SetPortWriteCallback(port_write_callback_t func, intptr_t ref);
 
     uint8_t Read(uint8_t reg);              // read from VIA register
     void Write(uint8_t reg, uint8_t data);  // write to VIA register
@@ -335,6 +353,27 @@ public:
     uint8_t getCA2State() { return ca2_state; }
     uint8_t getCB1State() { return (registers.ACR & SR_EXT) == SR_EXT ? cb1_state : cb1_state_sr; }
     uint8_t getCB2State() { return (registers.ACR & SR_IN_OUT) ? cb2_state_sr : cb2_state; };
+    // Changes every time timer 2 is started by writing T2CH, the BIOS does that at the start of every refresh
+    uint32_t getTimer2Starts() { return timer2_starts; }
+    // the bytes the delayed signals add to a state
+    size_t PendingStateSize() const { return delayed_signals.StateSize(); }
+
+    template<typename S>
+    void Serialize(S &s)
+    {
+        s.value(registers);
+        s.value(timer1);
+        s.value(timer2);
+        s.value(sr);
+        s.value(ca1_state);
+        s.value(ca2_state);
+        s.value(cb1_state);
+        s.value(cb2_state);
+        s.value(cb1_state_sr);
+        s.value(cb2_state_sr);
+        s.value(clk);
+        delayed_signals.Serialize(s);
+    }
 };
 
 #endif //VECTREXIA_VIA6522_H
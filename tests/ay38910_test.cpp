@@ -0,0 +1,206 @@
+#include <ay38910.h>
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace
+{
+
+// The envelope volume at every step, the period is 1 so a step is 2 ticks
+std::vector<int> envelope_steps(uint8_t shape, int steps)
+{
+    AY38910 psg;
+    psg.Write(PSG_REG_ENV_FINE, 1);
+    psg.Write(PSG_REG_ENV_COARSE, 0);
+    psg.Write(PSG_REG_ENV_CTRL, shape);
+
+    std::vector<int> volumes;
+    for (int i = 0; i < steps; i++) {
+        volumes.push_back(psg.envelope.volume());
+        psg.envelope.tick();
+        psg.envelope.tick();
+    }
+    return volumes;
+}
+
+std::vector<int> ramp(int from, int to)
+{
+    std::vector<int> out;
+    for (int v = from; v != to; v += (to > from) ? 1 : -1) {
+        out.push_back(v);
+    }
+    out.push_back(to);
+    return out;
+}
+
+std::vector<int> concat(std::initializer_list<std::vector<int>> parts)
+{
+    std::vector<int> out;
+    for (auto &part : parts) {
+        out.insert(out.end(), part.begin(), part.end());
+    }
+    return out;
+}
+
+}
+
+TEST(AY38910, Silence)
+{
+    AY38910 psg;
+    int16_t buffer[441];
+    psg.FillBuffer(buffer, 441);
+    for (auto sample : buffer) {
+        EXPECT_EQ(sample, 0);
+    }
+}
+
+TEST(AY38910, ToneFrequency)
+{
+    // tone A only, period 100 => 1.5MHz / (16 * 100) = 937.5Hz, at any output rate
+    for (uint32_t rate : { 44100u, 48000u, 96000u }) {
+        AY38910 psg;
+        psg.SetSampleRate(rate);
+        psg.Write(PSG_REG_MIXER_CTRL, 0x3e);
+        psg.Write(PSG_REG_A_FINE, 100);
+        psg.Write(PSG_REG_A_COARSE, 0);
+        psg.Write(PSG_REG_A_AMPL, 0xf);
+        EXPECT_DOUBLE_EQ(psg.channel_a.frequency_, 937.5);
+
+        std::vector<int16_t> buffer(rate);
+        psg.FillBuffer(buffer.data(), buffer.size());
+
+        // count the zero crossings, after the DC blocker has settled
+        int crossings = 0;
+        for (size_t i = rate / 10; i < buffer.size(); i++) {
+            crossings += (buffer[i] >= 0) != (buffer[i - 1] >= 0);
+        }
+        EXPECT_NEAR(crossings, 2 * 937.5 * 0.9, 4) << rate;
+    }
+}
+
+TEST(AY38910, FractionalSamplesPerFrame)
+{
+    // frames that do not last a whole number of samples do not drop or repeat any over time
+    for (uint32_t rate : { 44100u, 48000u, 96000u }) {
+        AY38910 psg;
+        psg.SetSampleRate(rate);
+
+        const uint64_t frame_cycles = 30011;
+        const int frames = 500;
+        std::vector<int16_t> buffer(4096);
+        size_t samples = 0;
+        for (int frame = 1; frame <= frames; frame++) {
+            psg.Render(frame * frame_cycles);
+            samples += psg.ReadSamples(buffer.data(), buffer.size());
+        }
+
+        const double expected = (double) (frames * frame_cycles) / AY38910::CYCLES_PER_TICK * rate / AY38910::TICK_RATE;
+        EXPECT_NEAR((double) samples, expected, 1.0) << rate;
+    }
+}
+
+TEST(AY38910, ToneAboveNyquistIsSilent)
+{
+    // period 3 => 31250Hz, a point sampled square wave would alias to 12850Hz at full volume
+    AY38910 psg;
+    psg.Write(PSG_REG_MIXER_CTRL, 0x3e);
+    psg.Write(PSG_REG_A_FINE, 3);
+    psg.Write(PSG_REG_A_COARSE, 0);
+    psg.Write(PSG_REG_A_AMPL, 0xf);
+
+    std::vector<int16_t> buffer(4410);
+    psg.FillBuffer(buffer.data(), buffer.size());
+
+    for (size_t i = 441; i < buffer.size(); i++) {
+        EXPECT_NEAR(buffer[i], 0, 0x200);
+    }
+}
+
+TEST(AY38910, EnvelopeShapes)
+{
+    const auto down = ramp(15, 0);
+    const auto up = ramp(0, 15);
+    const auto low = std::vector<int>(16, 0);
+    const auto high = std::vector<int>(16, 15);
+
+    EXPECT_EQ(envelope_steps(0x0, 48), concat({ down, low, low }));
+    EXPECT_EQ(envelope_steps(0x4, 48), concat({ up, low, low }));
+    EXPECT_EQ(envelope_steps(0x8, 48), concat({ down, down, down }));
+    EXPECT_EQ(envelope_steps(0x9, 48), concat({ down, low, low }));
+    EXPECT_EQ(envelope_steps(0xa, 48), concat({ down, up, down }));
+    EXPECT_EQ(envelope_steps(0xb, 48), concat({ down, high, high }));
+    EXPECT_EQ(envelope_steps(0xc, 48), concat({ up, up, up }));
+    EXPECT_EQ(envelope_steps(0xd, 48), concat({ up, high, high }));
+    EXPECT_EQ(envelope_steps(0xe, 48), concat({ up, down, up }));
+    EXPECT_EQ(envelope_steps(0xf, 48), concat({ up, low, low }));
+}
+
+TEST(AY38910, LoggedWriteTakesEffectAtItsCycle)
+{
+    // latch a register address and write a value through the bus, as the VIA does
+    auto bus_write = [](AY38910 &psg, uint64_t cycle, uint8_t reg, uint8_t value) {
+        psg.Step(cycle, reg, 1, 1, 1);
+        psg.Step(cycle, value, 0, 1, 1);
+        psg.Step(cycle, 0, 0, 1, 0);
+    };
+
+    // a tone on A at full volume is turned on 10ms into a 20ms frame
+    AY38910 psg;
+    bus_write(psg, 0, PSG_REG_MIXER_CTRL, 0x3e);
+    bus_write(psg, 0, PSG_REG_A_FINE, 100);
+    bus_write(psg, 0, PSG_REG_A_COARSE, 0);
+    bus_write(psg, AY38910::CLOCK / 100, PSG_REG_A_AMPL, 0xf);
+
+    // nothing is heard until the audio is rendered
+    EXPECT_EQ(psg.channel_a.amplitude_fixed, 0);
+    psg.Render(AY38910::CLOCK / 50);
+    EXPECT_EQ(psg.channel_a.amplitude_fixed, 0xf);
+    EXPECT_NEAR(psg.SamplesAvailable(), AY38910::DEFAULT_SAMPLE_RATE / 50, BlipBuffer::WIDTH);
+
+    std::vector<int16_t> buffer(AY38910::DEFAULT_SAMPLE_RATE / 50);
+    buffer.resize(psg.ReadSamples(buffer.data(), buffer.size()));
+
+    const size_t onset = AY38910::DEFAULT_SAMPLE_RATE / 100;
+    for (size_t i = 0; i < onset - BlipBuffer::WIDTH; i++) {
+        EXPECT_EQ(buffer[i], 0);
+    }
+    int loud = 0;
+    for (size_t i = onset + BlipBuffer::WIDTH; i < buffer.size(); i++) {
+        loud += std::abs(buffer[i]) > 0x1000;
+    }
+    EXPECT_GT(loud, (int) (buffer.size() - onset) / 2);
+}
+
+TEST(AY38910, NoiseJumpAhead)
+{
+    // shifting the LFSR many times at once matches a plain LFSR shifted one tick at a time
+    AY38910 psg;
+    psg.Write(PSG_REG_NOISE, 3);
+    auto jumped = psg.channel_noise;
+    const uint32_t period = jumped.period_ * 2u;
+    uint32_t rng = jumped.rng;
+    uint32_t count = jumped.count_;
+
+    for (uint32_t ticks : { 1u, 5u, 6u, 83u, 1000u, 4321u }) {
+        for (uint32_t i = 0; i < ticks; i++) {
+            if (++count >= period) {
+                count = 0;
+                rng = (rng >> 1) | (((rng ^ (rng >> 3)) & 1) << 16);
+            }
+        }
+        jumped.advance(ticks);
+        EXPECT_EQ(rng, jumped.rng);
+        EXPECT_EQ(count, jumped.count_);
+    }
+
+    // the output holds until the predicted change
+    for (int i = 0; i < 100; i++) {
+        const auto output = jumped.output();
+        const uint32_t change = jumped.until_change();
+        jumped.advance(change - 1);
+        EXPECT_EQ(jumped.output(), output);
+        jumped.advance(1);
+        if (change < 16 * 6) {
+            EXPECT_NE(jumped.output(), output);
+        }
+    }
+}
@@ -1,3 +1,6 @@
+#include <cstdio>
+#include <algorithm>
+#include <vector>
 #include <cartridge.h>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -37,11 +40,11 @@ TEST(CartridgeTest, TestLoad64K)
 
 TEST(CartridgeTest, TestLoadTooLarge)
 {
-    std::array<uint8_t, 0x10001> romdata;
-    romdata.fill(0xbe);
+    // 512 banks of 32K
+    std::vector<uint8_t> romdata(0x1000001, 0xbe);
 
     Cartridge cart;
-    cart.Load((const uint8_t *)romdata.data(), 0x10001);
+    cart.Load((const uint8_t *)romdata.data(), romdata.size());
 
     EXPECT_FALSE(cart.is_loaded());
 }
@@ -72,3 +75,106 @@ TEST(CartridgeTest, TestWrite)
     // rom should remain unchanged.
     EXPECT_EQ(0xde, cart.Read(0));
 }
+
+TEST(CartridgeTest, TestBankSwitch)
+{
+    std::array<uint8_t, 0x10000> romdata;
+    std::fill(romdata.begin(), romdata.begin() + 0x8000, 0x11);
+    std::fill(romdata.begin() + 0x8000, romdata.end(), 0x22);
+
+    Cartridge cart;
+    cart.Load((const uint8_t *)romdata.data(), 0x10000);
+
+    // PB6 high selects the first bank, writes do not switch banks
+    EXPECT_EQ(0x11, cart.Read(0x1234));
+    cart.SetPB6(0);
+    EXPECT_EQ(0x22, cart.Read(0x1234));
+    cart.Write(0, 0xff);
+    EXPECT_EQ(0x22, cart.Read(0x1234));
+    cart.SetPB6(1);
+    EXPECT_EQ(0x11, cart.Read(0x1234));
+}
+
+TEST(CartridgeTest, TestBankLatch)
+{
+    // 8 banks, each filled with its number
+    std::vector<uint8_t> romdata(8 * 0x8000);
+    for (size_t i = 0; i < romdata.size(); i++)
+        romdata[i] = (uint8_t) (i / 0x8000);
+
+    Cartridge cart;
+    cart.Load(romdata.data(), romdata.size());
+    EXPECT_TRUE(cart.is_loaded());
+
+    // the latch selects a pair of banks, PB6 the bank in the pair
+    EXPECT_EQ(0, cart.Read(0x100));
+    cart.SetPB6(0);
+    EXPECT_EQ(1, cart.Read(0x100));
+    cart.Write(0x7fff, 3);
+    EXPECT_EQ(7, cart.Read(0x100));
+    cart.SetPB6(1);
+    EXPECT_EQ(6, cart.Read(0x100));
+    cart.Write(0, 1);
+    EXPECT_EQ(2, cart.Read(0x100));
+}
+
+TEST(CartridgeTest, TestSharedImage)
+{
+    std::array<uint8_t, 0x8000> romdata;
+    romdata.fill(0x5a);
+    romdata[0x7fff] = 0xa5;
+
+    // a bank sized image is shared by the cartridges, not copied
+    auto image = RomImage::Wrap(romdata.data(), romdata.size());
+    Cartridge cart1, cart2;
+    cart1.Load(image);
+    cart2.Load(image);
+
+    EXPECT_TRUE(cart1.is_loaded());
+    EXPECT_TRUE(cart2.is_loaded());
+    romdata[0] = 0x77;
+    EXPECT_EQ(0x77, cart1.Read(0));
+    cart2.SetPB6(0);
+    EXPECT_EQ(0x77, cart2.Read(0));
+    EXPECT_EQ(0xa5, cart2.Read(0x7fff));
+}
+
+TEST(CartridgeTest, TestShortImagePadded)
+{
+    std::array<uint8_t, 0x1001> romdata;
+    romdata.fill(0xc3);
+
+    Cartridge cart;
+    cart.Load(RomImage::Wrap(romdata.data(), romdata.size()));
+
+    EXPECT_TRUE(cart.is_loaded());
+    EXPECT_EQ(0xc3, cart.Read(0x1000));
+    EXPECT_EQ(0x00, cart.Read(0x1001));
+    EXPECT_EQ(0x00, cart.Read(0x7fff));
+}
+
+TEST(CartridgeTest, TestMapImage)
+{
+    std::array<uint8_t, 0x8000> romdata;
+    for (size_t i = 0; i < romdata.size(); i++)
+        romdata[i] = (uint8_t) i;
+
+    const char *path = "cartridge_test_map.bin";
+    FILE *file = fopen(path, "wb");
+    ASSERT_NE(nullptr, file);
+    fwrite(romdata.data(), 1, romdata.size(), file);
+    fclose(file);
+
+    auto image = RomImage::Map(path);
+    ASSERT_NE(nullptr, image);
+    EXPECT_EQ(romdata.size(), image->size());
+
+    Cartridge cart;
+    cart.Load(image);
+    EXPECT_EQ(0x34, cart.Read(0x1234));
+
+    image.reset();
+    cart.Unload();
+    remove(path);
+    EXPECT_EQ(nullptr, RomImage::Map(path));
+}
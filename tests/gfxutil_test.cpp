@@ -17,6 +17,7 @@ You should have received a copy of the GNU General Public License
 along with Vectrexia.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <gtest/gtest.h>
+#include <vector>
 #include "gfxutil.h"
 
 TEST(Mono, TestARGBChannels)
@@ -107,3 +108,267 @@ TEST(GFXUtil, RectInit)
     EXPECT_TRUE(b.left == 0 && b.top == 0 && b.right == 10 && b.bottom == 10);
     EXPECT_TRUE(c.left == 10 && c.top == 10 && c.right == 20 && c.bottom == 20);
 }
+
+TEST(GFXUtil, SpanMerge)
+{
+    vxgfx::span_t a;
+    EXPECT_TRUE(a.empty());
+
+    a.add(5);
+    a.add(2);
+    EXPECT_EQ(a.left, 2);
+    EXPECT_EQ(a.right, 6);
+
+    auto b = vxgfx::merge(a, vxgfx::span_t(10, 12));
+    EXPECT_EQ(b.left, 2);
+    EXPECT_EQ(b.right, 12);
+    EXPECT_EQ(vxgfx::merge(a, vxgfx::span_t()).width(), 4);
+}
+
+TEST(GFXUtil, TrackedFramebufferSpans)
+{
+    vxgfx::tracked_framebuffer<16, 8, vxgfx::pf_mono_t> fb;
+
+    vxgfx::draw_line<vxgfx::m_direct>(fb, 2, 1, 9, 1, vxgfx::pf_mono_t{1.0f});
+    EXPECT_EQ(fb.dirty(1).left, 2);
+    EXPECT_EQ(fb.dirty(1).right, 10);
+    EXPECT_TRUE(fb.dirty(0).empty());
+
+    // the next frame clears the line, but the row stays dirty so the output is updated
+    fb.clear();
+    EXPECT_FLOAT_EQ(fb.get_pixel(5, 1).value, 0.0f);
+    EXPECT_TRUE(fb.touched(1).empty());
+    EXPECT_EQ(fb.dirty(1).width(), 8);
+
+    fb.plot_pixel(3, 4, vxgfx::m_direct(), vxgfx::pf_mono_t{0.5f});
+    EXPECT_EQ(fb.dirty(4).width(), 1);
+
+    // after another frame, the first line is no longer dirty
+    fb.clear();
+    EXPECT_TRUE(fb.dirty(1).empty());
+    EXPECT_EQ(fb.dirty(4).width(), 1);
+}
+
+TEST(ARGB, TestBlendEndpoints)
+{
+    auto a = vxgfx::pf_argb_t(0x80, 0x10, 0x80, 0xf0);
+    auto b = vxgfx::pf_argb_t(0xff, 0xf0, 0x20, 0x00);
+
+    EXPECT_EQ(a.blend_fixed(b, 0).value, a.value);
+    EXPECT_EQ(a.blend_fixed(b, vxgfx::BLEND_ONE).value, b.value);
+    EXPECT_EQ(a.blend(b, 1.0f).value, b.value);
+}
+
+TEST(ARGB, TestBlendLinearLight)
+{
+    // half way between black and white in linear light is ~0xbb in sRGB
+    auto black = vxgfx::pf_argb_t(0x00, 0x00, 0x00);
+    auto white = vxgfx::pf_argb_t(0xff, 0xff, 0xff);
+    auto mid = black.blend(white, 0.5f);
+
+    EXPECT_EQ(mid.comp_a(mid), 0xffu);
+    EXPECT_NEAR(static_cast<int>(mid.comp_r(mid)), 0xbb, 1);
+    EXPECT_EQ(mid.comp_r(mid), mid.comp_g(mid));
+    EXPECT_EQ(mid.comp_r(mid), mid.comp_b(mid));
+}
+
+TEST(ARGB, TestBlendRowMatchesPixelBlend)
+{
+    std::array<vxgfx::pf_argb_t, 131> dst, src, expected;
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < dst.size(); i++) {
+        seed = seed * 1103515245u + 12345u;
+        dst[i] = vxgfx::pf_argb_t(seed);
+        seed = seed * 1103515245u + 12345u;
+        src[i] = vxgfx::pf_argb_t(seed);
+    }
+
+    for (unsigned weight : {0u, 1u, 77u, 128u, 255u, 256u}) {
+        auto out = dst;
+        for (size_t i = 0; i < dst.size(); i++) {
+            expected[i] = dst[i].blend_fixed(src[i], weight);
+        }
+        vxgfx::blend_row(out.data(), src.data(), out.size(), weight);
+        for (size_t i = 0; i < dst.size(); i++) {
+            EXPECT_EQ(out[i].value, expected[i].value);
+        }
+    }
+}
+
+TEST(Mono, TestMonoIntIntensity)
+{
+    EXPECT_EQ(vxgfx::pf_mono8_t(1.0f).value, 0xff);
+    EXPECT_EQ(vxgfx::pf_mono8_t(0.0f).value, 0x00);
+    EXPECT_EQ(vxgfx::pf_mono8_t(2.0f).value, 0xff);
+    EXPECT_EQ(vxgfx::pf_mono16_t(1.0f).value, 0xffff);
+    EXPECT_EQ(vxgfx::pf_mono16_t(1.0f).c8(), 0xff);
+    EXPECT_EQ(vxgfx::pf_mono16_t(0.5f).c8(), 0x80);
+    EXPECT_NEAR(vxgfx::pf_mono_t(0.5f).c8(), vxgfx::pf_mono8_t(0.5f).c8(), 1);
+}
+
+TEST(Mono, TestMonoIntSaturatingAdd)
+{
+    vxgfx::tracked_framebuffer<4, 4, vxgfx::pf_mono8_t> fb;
+
+    fb.plot_pixel(1, 1, vxgfx::m_brightness(), vxgfx::pf_mono8_t(0.75f));
+    fb.plot_pixel(1, 1, vxgfx::m_brightness(), vxgfx::pf_mono8_t(0.75f));
+    EXPECT_EQ(fb.get_pixel(1, 1).value, 0xff);
+
+    auto p = vxgfx::pf_mono16_t(0.25f);
+    p += 0.25f;
+    EXPECT_EQ(p.value, vxgfx::pf_mono16_t(0.5f).value);
+}
+
+template<typename Pf>
+static std::vector<Pf> random_mono(size_t n)
+{
+    std::vector<Pf> out(n);
+    uint32_t seed = 4321;
+    for (auto &p : out) {
+        seed = seed * 1103515245u + 12345u;
+        // slightly out of range values must be clamped
+        p = Pf{ static_cast<float>(seed >> 8 & 0xffff) / 60000.0f - 0.05f };
+    }
+    return out;
+}
+
+template<typename Pf>
+static void check_convert_row()
+{
+    for (size_t n : {1u, 15u, 16u, 37u, 330u}) {
+        auto src = random_mono<Pf>(n);
+        std::vector<uint8_t> grey(n);
+        std::vector<vxgfx::pf_rgb565_t> rgb565(n);
+        std::vector<vxgfx::pf_argb_t> xrgb(n);
+        std::vector<vxgfx::pf_rgba_t> rgba(n);
+
+        vxgfx::convert_row(src.data(), grey.data(), n);
+        vxgfx::convert_row(src.data(), rgb565.data(), n);
+        vxgfx::convert_row(src.data(), xrgb.data(), n);
+        vxgfx::convert_row(src.data(), rgba.data(), n);
+
+        for (size_t i = 0; i < n; i++) {
+            const auto c = src[i].c8();
+            EXPECT_EQ(grey[i], c);
+            EXPECT_EQ(rgb565[i].value, vxgfx::pf_rgb565_t(c, c, c).value);
+            EXPECT_EQ(xrgb[i].value, vxgfx::pf_argb_t(c, c, c).value);
+            EXPECT_TRUE(rgba[i].r == c && rgba[i].g == c && rgba[i].b == c && rgba[i].a == 0xff);
+        }
+    }
+}
+
+TEST(Convert, MonoToOutputFormats)
+{
+    check_convert_row<vxgfx::pf_mono_t>();
+    check_convert_row<vxgfx::pf_mono16_t>();
+    check_convert_row<vxgfx::pf_mono8_t>();
+}
+
+TEST(Convert, TintPalette)
+{
+    auto pal = vxgfx::palette<vxgfx::pf_argb_t>::tint(vxgfx::pf_argb_t(0x00, 0xff, 0x80));
+    EXPECT_EQ(pal.lut[0].value, vxgfx::pf_argb_t(0, 0, 0).value);
+    EXPECT_EQ(pal.lut[255].value, vxgfx::pf_argb_t(0x00, 0xff, 0x80).value);
+
+    std::array<vxgfx::pf_mono8_t, 2> src{ vxgfx::pf_mono8_t(0.0f), vxgfx::pf_mono8_t(1.0f) };
+    std::array<vxgfx::pf_argb_t, 2> dst;
+    vxgfx::convert_row(src.data(), dst.data(), src.size(), pal);
+    EXPECT_EQ(dst[1].value, vxgfx::pf_argb_t(0x00, 0xff, 0x80).value);
+
+    auto pal565 = vxgfx::palette<vxgfx::pf_rgb565_t>::tint(vxgfx::pf_argb_t(0xff, 0xff, 0xff));
+    EXPECT_EQ(pal565.lut[255].value, 0xffff);
+}
+
+TEST(Composite, RowMatchesScalar)
+{
+    const size_t n = 45;
+    std::vector<vxgfx::pf_argb_t> src(n);
+    std::vector<vxgfx::pf_rgb565_t> dst565(n);
+    std::vector<vxgfx::pf_argb_t> dst8888(n);
+    uint32_t seed = 999;
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        src[i] = vxgfx::pf_argb_t(seed);
+        seed = seed * 1103515245u + 12345u;
+        dst565[i].value = static_cast<uint16_t>(seed >> 16);
+        dst8888[i] = vxgfx::pf_argb_t(seed);
+    }
+    // a fully transparent group, a fully opaque pixel
+    for (size_t i = 8; i < 16; i++) {
+        src[i] = vxgfx::pf_argb_t(0x00ffffffu);
+    }
+    src[20] = vxgfx::pf_argb_t(0xff, 0x12, 0x34, 0x56);
+
+    auto out565 = dst565;
+    auto out8888 = dst8888;
+    vxgfx::composite_row(out565.data(), src.data(), n);
+    vxgfx::composite_row(out8888.data(), src.data(), n);
+
+    for (size_t i = 0; i < n; i++) {
+        const auto a = vxgfx::pf_argb_t::comp_a(src[i]);
+        const auto c = [&](uint32_t d, uint32_t s) {
+            return vxgfx::composite_channel(static_cast<uint8_t>(d), static_cast<uint8_t>(s), a);
+        };
+        const auto r5 = vxgfx::pf_rgb565_t::comp_r(dst565[i]);
+        const auto g6 = vxgfx::pf_rgb565_t::comp_g(dst565[i]);
+        const auto b5 = vxgfx::pf_rgb565_t::comp_b(dst565[i]);
+        const auto expected565 = (a == 0) ? dst565[i] : vxgfx::pf_rgb565_t(
+            c(r5 << 3 | r5 >> 2, vxgfx::pf_argb_t::comp_r(src[i])),
+            c(g6 << 2 | g6 >> 4, vxgfx::pf_argb_t::comp_g(src[i])),
+            c(b5 << 3 | b5 >> 2, vxgfx::pf_argb_t::comp_b(src[i])));
+        const auto expected8888 = vxgfx::pf_argb_t(
+            static_cast<uint8_t>(vxgfx::pf_argb_t::comp_a(dst8888[i])),
+            c(vxgfx::pf_argb_t::comp_r(dst8888[i]), vxgfx::pf_argb_t::comp_r(src[i])),
+            c(vxgfx::pf_argb_t::comp_g(dst8888[i]), vxgfx::pf_argb_t::comp_g(src[i])),
+            c(vxgfx::pf_argb_t::comp_b(dst8888[i]), vxgfx::pf_argb_t::comp_b(src[i])));
+        EXPECT_EQ(out565[i].value, expected565.value);
+        EXPECT_EQ(out8888[i].value, expected8888.value);
+    }
+    EXPECT_EQ(out565[10].value, dst565[10].value);
+    EXPECT_EQ(out8888[20].value, (dst8888[20].value & 0xff000000u) | 0x123456u);
+}
+
+TEST(Composite, OverlaySpans)
+{
+    vxgfx::tracked_framebuffer<8, 4, vxgfx::pf_argb_t> overlay{ vxgfx::pf_argb_t(0) };
+    vxgfx::framebuffer<8, 4, vxgfx::pf_argb_t> out{ vxgfx::pf_argb_t(0x10, 0x10, 0x10) };
+
+    overlay.plot_pixel(2, 1, vxgfx::m_direct(), vxgfx::pf_argb_t(0xff, 0xff, 0x00, 0x00));
+    vxgfx::composite(out, overlay);
+    EXPECT_EQ(out.get_pixel(2, 1).value, vxgfx::pf_argb_t(0xff, 0x00, 0x00).value);
+    EXPECT_EQ(out.get_pixel(3, 1).value, vxgfx::pf_argb_t(0x10, 0x10, 0x10).value);
+
+    overlay.clear();
+    EXPECT_TRUE(overlay.touched(1).empty());
+    EXPECT_EQ(overlay.dirty(1).left, 2);
+    EXPECT_EQ(overlay.dirty(1).right, 3);
+    EXPECT_EQ(overlay.get_pixel(2, 1).value, 0u);
+}
+
+TEST(Text, GlyphAtlasMatchesDrawText)
+{
+    const std::string text = "Channel A: 93750Hz";
+    // inside, and clipped on the left, right and bottom edges
+    for (auto pos : { vxgfx::point_t{ 2, 3 }, vxgfx::point_t{ -5, 0 }, vxgfx::point_t{ 100, 28 } }) {
+        vxgfx::tracked_framebuffer<128, 32, vxgfx::pf_argb_t> expected{ vxgfx::pf_argb_t(0) };
+        vxgfx::tracked_framebuffer<128, 32, vxgfx::pf_argb_t> actual{ vxgfx::pf_argb_t(0) };
+        const auto colour = vxgfx::pf_argb_t(0xc0, 0x00, 0xff, 0x00);
+        const vxgfx::glyph_atlas<vxgfx::pf_argb_t> atlas(colour);
+
+        vxgfx::draw_text<vxgfx::m_direct>(expected, pos.x, pos.y, colour, text);
+        vxgfx::draw_text(actual, atlas, pos.x, pos.y, text.data(), text.size());
+
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 128; x++) {
+                EXPECT_EQ(actual.get_pixel(x, y).value, expected.get_pixel(x, y).value);
+            }
+            // the touched spans cover every drawn pixel
+            const auto &a = actual.touched(y);
+            const auto &e = expected.touched(y);
+            if (!e.empty()) {
+                EXPECT_LE(a.left, e.left);
+                EXPECT_GE(a.right, e.right);
+            }
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#include <cstdint>
+#include <vector>
+#include <rewindbuffer.h>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+// A state of size bytes that differs from the one before it in a few bytes
+static std::vector<uint8_t> MakeState(int n, size_t size)
+{
+    std::vector<uint8_t> state(size, 0x5a);
+    for (size_t i = 0; i < size; i += 97)
+        state[i] = (uint8_t) (i * 7);
+    state[(n * 13) % size] = (uint8_t) n;
+    state[size - 1] = (uint8_t) (n >> 8);
+    return state;
+}
+
+static std::vector<uint8_t> Rewind(RewindBuffer &buffer)
+{
+    size_t size = 0;
+    const uint8_t *state = buffer.Rewind(size);
+    return state ? std::vector<uint8_t>(state, state + size) : std::vector<uint8_t>();
+}
+
+TEST(RewindBufferTest, RewindsInOrder)
+{
+    RewindBuffer buffer(1 << 16, 64);
+    std::vector<std::vector<uint8_t>> states;
+    for (int n = 0; n < 10; n++)
+    {
+        // the size changes too, and is not a multiple of a word
+        states.push_back(MakeState(n, 1021 + (n % 3) * 5));
+        ASSERT_TRUE(buffer.Push(states.back().data(), states.back().size()));
+    }
+    EXPECT_EQ(10u, buffer.Count());
+    // the deltas are much smaller than the states
+    EXPECT_LT(buffer.Used(), 9u * 64);
+
+    for (int n = 9; n >= 0; n--)
+        EXPECT_EQ(states[n], Rewind(buffer));
+
+    // the oldest is all that is left
+    EXPECT_EQ(states[0], Rewind(buffer));
+    EXPECT_EQ(1u, buffer.Count());
+}
+
+TEST(RewindBufferTest, PushAfterRewind)
+{
+    RewindBuffer buffer(1 << 16, 64);
+    std::vector<std::vector<uint8_t>> states;
+    for (int n = 0; n < 5; n++)
+    {
+        states.push_back(MakeState(n, 512));
+        buffer.Push(states.back().data(), states.back().size());
+    }
+
+    EXPECT_EQ(states[4], Rewind(buffer));
+    EXPECT_EQ(states[3], Rewind(buffer));
+
+    // carry on from state 3, it stays a checkpoint
+    auto state = MakeState(100, 600);
+    buffer.Push(state.data(), state.size());
+    EXPECT_EQ(5u, buffer.Count());
+    EXPECT_EQ(state, Rewind(buffer));
+    EXPECT_EQ(states[3], Rewind(buffer));
+    EXPECT_EQ(states[2], Rewind(buffer));
+}
+
+TEST(RewindBufferTest, DropsOldestWhenFull)
+{
+    // room for a few deltas of a very different state
+    RewindBuffer buffer(4096, 1000);
+    std::vector<std::vector<uint8_t>> states;
+    for (int n = 0; n < 100; n++)
+    {
+        states.push_back(std::vector<uint8_t>(1000, (uint8_t) n));
+        ASSERT_TRUE(buffer.Push(states.back().data(), states.back().size()));
+        EXPECT_LE(buffer.Used(), 4096u);
+    }
+    const size_t count = buffer.Count();
+    EXPECT_GT(count, 2u);
+    EXPECT_LT(count, 100u);
+
+    for (size_t n = 0; n < count; n++)
+        EXPECT_EQ(states[99 - n], Rewind(buffer));
+    EXPECT_EQ(states[100 - count], Rewind(buffer));
+
+    // a limited number of checkpoints
+    RewindBuffer limited(1 << 16, 4);
+    for (const auto &state : states)
+        limited.Push(state.data(), state.size());
+    EXPECT_EQ(5u, limited.Count());
+}
+
+TEST(RewindBufferTest, DeltaLargerThanBuffer)
+{
+    RewindBuffer buffer(256, 16);
+    std::vector<uint8_t> a(1000, 1), b(1000, 2);
+    EXPECT_TRUE(buffer.Push(a.data(), a.size()));
+    EXPECT_FALSE(buffer.Push(b.data(), b.size()));
+    EXPECT_EQ(1u, buffer.Count());
+    EXPECT_EQ(b, Rewind(buffer));
+
+    buffer.Clear();
+    EXPECT_EQ(0u, buffer.Count());
+    size_t size;
+    EXPECT_EQ(nullptr, buffer.Rewind(size));
+}
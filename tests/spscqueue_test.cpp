@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <thread>
+#include <spscqueue.h>
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+TEST(SPSCQueueTest, FullAndEmpty)
+{
+    SPSCQueue<int, 4> queue;
+    int value = 0;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.pop(value));
+
+    for (int n = 0; n < 4; n++)
+        EXPECT_TRUE(queue.push(n));
+    EXPECT_FALSE(queue.push(4));
+
+    // first in, first out, and the slots are reused around the ring
+    for (int n = 0; n < 10; n++)
+    {
+        ASSERT_TRUE(queue.pop(value));
+        EXPECT_EQ(n, value);
+        EXPECT_TRUE(queue.push(n + 4));
+    }
+    EXPECT_FALSE(queue.empty());
+}
+
+TEST(SPSCQueueTest, BetweenThreads)
+{
+    const uint32_t count = 200000;
+    SPSCQueue<uint32_t, 8> queue;
+
+    std::thread producer([&] {
+        for (uint32_t n = 0; n < count; n++)
+            while (!queue.push(n))
+                std::this_thread::yield();
+    });
+
+    // every value arrives once, in order
+    uint32_t expected = 0;
+    while (expected < count)
+    {
+        uint32_t value;
+        if (!queue.pop(value))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        if (value != expected)
+            break;
+        expected++;
+    }
+    producer.join();
+
+    EXPECT_EQ(count, expected);
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,39 @@
+#include <vectorizer.h>
+#include <gtest/gtest.h>
+
+TEST(Vectorizer, IntegrateOneCycle)
+{
+    // +2.5v on both integrators for one 1.5MHz cycle moves the beam by 10000 * 2.5 / 1.5e6 volts
+    axes_t axes;
+    integrators_t integrators;
+    integrators.x = 128;
+    integrators.y = -128;
+
+    axes.integrate(TIME_UNITS_PER_CYCLE, integrators);
+
+    EXPECT_FLOAT_EQ(axes.volts_x(), 10000.0f * 2.5f / 1.5e6f);
+    EXPECT_FLOAT_EQ(axes.volts_y(), -10000.0f * 2.5f / 1.5e6f);
+}
+
+TEST(Vectorizer, IntegrateIsExact)
+{
+    // integrating in two parts of a cycle must land on exactly the same position as a whole cycle
+    axes_t whole, split;
+    integrators_t integrators;
+    integrators.x = 77;
+    integrators.y = -3;
+
+    whole.integrate(TIME_UNITS_PER_CYCLE, integrators);
+    split.integrate(467 * TIME_UNITS_PER_NANO, integrators);
+    split.integrate(TIME_UNITS_PER_CYCLE - 467 * TIME_UNITS_PER_NANO, integrators);
+
+    EXPECT_EQ(whole.x, split.x);
+    EXPECT_EQ(whole.y, split.y);
+}
+
+TEST(Vectorizer, TimerConversions)
+{
+    EXPECT_EQ(TimerUtil::nanos_to_cycles(7800), 11u);
+    EXPECT_EQ(TimerUtil::cycles_to_nanos(11), 7333u);
+    EXPECT_EQ(TimerUtil::cycles_to_nanos(3), 2000u);
+}
@@ -1,4 +1,220 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 
+#include <cstring>
+#include <vector>
 #include <vectrexia.h>
+
+static const uint64_t CYCLES_PER_FRAME = 30000;
+
+// Run a frame like the libretro core does, and return the audio
+static std::vector<int16_t> RunFrame(Vectrex &vectrex)
+{
+    std::vector<int16_t> samples(2048);
+    vectrex.Run(CYCLES_PER_FRAME);
+    vectrex.psg_->Render(vectrex.cycles);
+    samples.resize(vectrex.psg_->ReadSamples(samples.data(), samples.size()));
+    vectrex.getFramebuffer();
+    return samples;
+}
+
+static void CenterControls(Vectrex &vectrex)
+{
+    vectrex.SetPlayerOne(0x80, 0x80, 0, 0, 0, 0);
+    vectrex.SetPlayerTwo(0x80, 0x80, 0, 0, 0, 0);
+}
+
+static std::vector<uint8_t> SaveState(Vectrex &vectrex)
+{
+    std::vector<uint8_t> state(vectrex.SaveState(nullptr, 0));
+    EXPECT_EQ(state.size(), vectrex.SaveState(state.data(), state.size()));
+    return state;
+}
+
+TEST(VectrexTest, SaveStateRoundTrip)
+{
+    Vectrex vectrex, loaded;
+    CenterControls(vectrex);
+    CenterControls(loaded);
+
+    vectrex.Reset();
+    // the BIOS plays its music from about 5 seconds in
+    for (int frame = 0; frame < 260; frame++)
+        RunFrame(vectrex);
+
+    auto state = SaveState(vectrex);
+    ASSERT_GT(state.size(), 1024u);
+    ASSERT_TRUE(loaded.LoadState(state.data(), state.size()));
+    EXPECT_EQ(state, SaveState(loaded));
+
+    // both carry on exactly the same
+    bool sound = false;
+    for (int frame = 0; frame < 20; frame++)
+    {
+        auto expected = RunFrame(vectrex);
+        EXPECT_EQ(expected, RunFrame(loaded));
+        for (auto sample : expected)
+            sound |= sample != 0;
+    }
+    EXPECT_TRUE(sound);
+    EXPECT_EQ(vectrex.cycles, loaded.cycles);
+    EXPECT_EQ(SaveState(vectrex), SaveState(loaded));
+}
+
+TEST(VectrexTest, SaveStateTooSmall)
+{
+    Vectrex vectrex;
+    CenterControls(vectrex);
+    vectrex.Reset();
+    RunFrame(vectrex);
+
+    auto size = vectrex.SaveState(nullptr, 0);
+    std::vector<uint8_t> state(size - 1);
+    EXPECT_EQ(0u, vectrex.SaveState(state.data(), state.size()));
+}
+
+TEST(VectrexTest, LoadStateRejectsBadState)
+{
+    Vectrex vectrex;
+    CenterControls(vectrex);
+    vectrex.Reset();
+    for (int frame = 0; frame < 10; frame++)
+        RunFrame(vectrex);
+    auto state = SaveState(vectrex);
+
+    Vectrex loaded;
+    // truncated
+    EXPECT_FALSE(loaded.LoadState(state.data(), state.size() / 2));
+    EXPECT_FALSE(loaded.LoadState(state.data(), 4));
+
+    // not a savestate
+    auto bad_magic = state;
+    bad_magic[0] ^= 0xff;
+    EXPECT_FALSE(loaded.LoadState(bad_magic.data(), bad_magic.size()));
+
+    // saved without a cartridge
+    std::vector<uint8_t> rom(0x8000, 0x12);
+    loaded.LoadCartridge(rom.data(), rom.size());
+    EXPECT_FALSE(loaded.LoadState(state.data(), state.size()));
+
+    // a larger buffer is fine
+    Vectrex other;
+    state.resize(state.size() + 100);
+    EXPECT_TRUE(other.LoadState(state.data(), state.size()));
+}
+
+TEST(VectrexTest, FramesCarryOverrun)
+{
+    Vectrex vectrex;
+    CenterControls(vectrex);
+    vectrex.Reset();
+
+    // instructions run past the end of a frame, but the frames average the cycles asked for
+    for (int frame = 0; frame < 100; frame++)
+        vectrex.RunFrame(CYCLES_PER_FRAME);
+    EXPECT_LT(vectrex.cycles - 100 * CYCLES_PER_FRAME, 8u);
+}
+
+TEST(VectrexTest, FramesSyncedToRefresh)
+{
+    Vectrex vectrex;
+    CenterControls(vectrex);
+    vectrex.Reset();
+
+    // the BIOS refreshes every 30000 cycles or so, timer 2 is loaded with 0x7530
+    for (int frame = 0; frame < 50; frame++)
+        vectrex.RunFrame(2 * CYCLES_PER_FRAME, true);
+    EXPECT_NEAR(30000, (double) vectrex.RefreshPeriod(), 50);
+
+    // a frame lasts from one refresh to the next
+    for (int frame = 0; frame < 10; frame++)
+        EXPECT_EQ(vectrex.RefreshPeriod(), vectrex.RunFrame(2 * CYCLES_PER_FRAME, true));
+}
+
+static uint64_t FakeTicks()
+{
+    static uint64_t ticks = 0;
+    return ticks += 10;
+}
+
+TEST(VectrexTest, PerfCountersTimeTheFrame)
+{
+    Vectrex vectrex, untimed;
+    CenterControls(vectrex);
+    CenterControls(untimed);
+    vectrex.Reset();
+    untimed.Reset();
+
+    PerfCounters perf(FakeTicks);
+    vectrex.SetPerfCounters(&perf);
+    uint64_t cycles_run = 0;
+    for (int frame = 0; frame < 5; frame++)
+    {
+        cycles_run += vectrex.RunFrame(CYCLES_PER_FRAME);
+        vectrex.getFramebuffer();
+        untimed.RunFrame(CYCLES_PER_FRAME);
+        untimed.getFramebuffer();
+    }
+
+    EXPECT_GT(perf.Calls(PerfCounters::CPU), 0u);
+    EXPECT_EQ(cycles_run, perf.Calls(PerfCounters::VIA));
+    EXPECT_EQ(cycles_run, perf.Calls(PerfCounters::VECTORIZER));
+    EXPECT_EQ(5u, perf.Calls(PerfCounters::SEGMENTS));
+    for (auto section : {PerfCounters::CPU, PerfCounters::VIA, PerfCounters::VECTORIZER, PerfCounters::SEGMENTS,
+                         PerfCounters::RASTER})
+        EXPECT_GT(perf.Total(section), 0u) << PerfCounters::Name(section);
+
+    // timing does not change the emulation
+    EXPECT_EQ(SaveState(untimed), SaveState(vectrex));
+
+    vectrex.SetPerfCounters(nullptr);
+    perf.Reset();
+    vectrex.RunFrame(CYCLES_PER_FRAME);
+    EXPECT_EQ(0u, perf.Calls(PerfCounters::CPU));
+}
+
+TEST(VectrexTest, DamagedStateKeepsTheMachine)
+{
+    Vectrex vectrex, other;
+    CenterControls(vectrex);
+    CenterControls(other);
+    vectrex.Reset();
+    other.Reset();
+    for (int frame = 0; frame < 10; frame++)
+        RunFrame(vectrex);
+    for (int frame = 0; frame < 30; frame++)
+        RunFrame(other);
+
+    // a state from another point that is cut short, but whose header says that is its size, fails part way through
+    auto damaged = SaveState(other);
+    damaged.resize(damaged.size() / 2);
+    const auto length = (uint32_t) damaged.size();
+    memcpy(damaged.data() + 3 * sizeof(uint32_t), &length, sizeof(length));
+
+    std::vector<uint8_t> before(vectrex.SaveState(nullptr, 0, false));
+    vectrex.SaveState(before.data(), before.size(), false);
+    EXPECT_FALSE(vectrex.LoadState(damaged.data(), damaged.size()));
+
+    std::vector<uint8_t> after(vectrex.SaveState(nullptr, 0, false));
+    vectrex.SaveState(after.data(), after.size(), false);
+    EXPECT_EQ(before, after);
+}
+
+TEST(VectrexTest, MaxStateSizeIsStable)
+{
+    Vectrex vectrex;
+    CenterControls(vectrex);
+    vectrex.Reset();
+
+    // the BIOS draws up to 25k vectors, the state grows from a few KB to hundreds
+    const size_t max_size = vectrex.MaxStateSize();
+    size_t largest = 0;
+    for (int frame = 0; frame < 300; frame++)
+    {
+        RunFrame(vectrex);
+        largest = std::max(largest, vectrex.SaveState(nullptr, 0));
+        ASSERT_LE(vectrex.SaveState(nullptr, 0), max_size);
+        EXPECT_EQ(max_size, vectrex.MaxStateSize());
+    }
+    EXPECT_GT(largest, 100000u);
+}
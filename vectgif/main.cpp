@@ -73,13 +73,8 @@ int main(int argc, char *argv[])
 
     auto framebuffer = vectrex->getFramebuffer();
 
-    auto gb = gif_buffer.begin();
-    for (auto &fb : *framebuffer) {
-      *++gb = static_cast<uint8_t>(fb.value * 0xffu);
-      *++gb = static_cast<uint8_t>(fb.value * 0xffu);
-      *++gb = static_cast<uint8_t>(fb.value * 0xffu);
-      *++gb = static_cast<uint8_t>(fb.value * 0xffu);
-    }
+    vxgfx::convert_row(framebuffer->data(), reinterpret_cast<vxgfx::pf_rgba_t *>(gif_buffer.data()),
+                       framebuffer->size());
       GifWriteFrame(&gw, gif_buffer.data(), FRAME_WIDTH, FRAME_HEIGHT, 2);
     if (frame % 100 == 0) {
       printf("[VECTREX] frame = %d\n", frame);